@@ -0,0 +1,503 @@
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+
+#include "arrow.h"
+
+// ownership of exported structs, freed by the release callbacks
+
+struct ExportedSchema
+{
+    std::string m_format;
+    std::string m_name;
+    std::vector<ArrowSchema*> m_children;
+    ArrowSchema* m_dictionary = nullptr;
+};
+
+struct ExportedArray
+{
+    std::vector<std::uint8_t> m_validity;
+    std::vector<std::int32_t> m_ints;
+    std::vector<double> m_doubles;
+    std::vector<std::int32_t> m_offsets;
+    std::vector<std::int64_t> m_largeOffsets;
+    std::string m_chars;
+
+    std::vector<const void*> m_buffers;
+    std::vector<ArrowArray*> m_children;
+    ArrowArray* m_dictionary = nullptr;
+};
+
+static void releaseSchema(ArrowSchema* schema)
+{
+    auto holder = static_cast<ExportedSchema*>(schema->private_data);
+    for (ArrowSchema* child : holder->m_children)
+    {
+        if (child->release)
+            child->release(child);
+        delete child;
+    }
+    if (holder->m_dictionary)
+    {
+        if (holder->m_dictionary->release)
+            holder->m_dictionary->release(holder->m_dictionary);
+        delete holder->m_dictionary;
+    }
+    delete holder;
+    schema->release = nullptr;
+}
+
+static void releaseArray(ArrowArray* array)
+{
+    auto holder = static_cast<ExportedArray*>(array->private_data);
+    for (ArrowArray* child : holder->m_children)
+    {
+        if (child->release)
+            child->release(child);
+        delete child;
+    }
+    if (holder->m_dictionary)
+    {
+        if (holder->m_dictionary->release)
+            holder->m_dictionary->release(holder->m_dictionary);
+        delete holder->m_dictionary;
+    }
+    delete holder;
+    array->release = nullptr;
+}
+
+static void fillSchema(ArrowSchema* schema, ExportedSchema* holder, std::int64_t flags)
+{
+    schema->format = holder->m_format.c_str();
+    schema->name = holder->m_name.c_str();
+    schema->metadata = nullptr;
+    schema->flags = flags;
+    schema->n_children = std::int64_t(holder->m_children.size());
+    schema->children = holder->m_children.empty() ? nullptr : holder->m_children.data();
+    schema->dictionary = holder->m_dictionary;
+    schema->release = releaseSchema;
+    schema->private_data = holder;
+}
+
+static void fillArray(ArrowArray* array, ExportedArray* holder, std::int64_t length, std::int64_t nullCount)
+{
+    array->length = length;
+    array->null_count = nullCount;
+    array->offset = 0;
+    array->n_buffers = std::int64_t(holder->m_buffers.size());
+    array->buffers = holder->m_buffers.data();
+    array->n_children = std::int64_t(holder->m_children.size());
+    array->children = holder->m_children.empty() ? nullptr : holder->m_children.data();
+    array->dictionary = holder->m_dictionary;
+    array->release = releaseArray;
+    array->private_data = holder;
+}
+
+// utf8 layout: validity, offsets, characters
+// offsets are collected as int64 and narrowed once all text is in
+static void appendText(ExportedArray* holder, const std::string& text)
+{
+    holder->m_chars.append(text);
+    holder->m_largeOffsets.push_back(std::int64_t(holder->m_chars.size()));
+}
+
+// int32 offsets ("u") unless the characters pass 2 GiB, then int64 ("U")
+static void finishText(ExportedSchema* sholder, ExportedArray* holder)
+{
+    if (holder->m_chars.size() <= std::size_t(std::numeric_limits<std::int32_t>::max()))
+    {
+        sholder->m_format = "u";
+        holder->m_offsets.assign(holder->m_largeOffsets.begin(), holder->m_largeOffsets.end());
+        holder->m_largeOffsets = {};
+        holder->m_buffers = { nullptr, holder->m_offsets.data(), holder->m_chars.data() };
+    }
+    else
+    {
+        sholder->m_format = "U";
+        holder->m_buffers = { nullptr, holder->m_largeOffsets.data(), holder->m_chars.data() };
+    }
+}
+
+static void exportColumn(const Tabular& table, std::size_t column, ArrowSchema* schema, ArrowArray* array)
+{
+    const ColumnDefinition& cd = table.getSchema().columns()[column];
+    std::size_t n = table.nRows();
+
+    auto sholder = new ExportedSchema();
+    sholder->m_name = cd.getName();
+
+    auto aholder = new ExportedArray();
+    aholder->m_validity.assign((n + 7) / 8, 0);
+    std::int64_t nulls = 0;
+    auto setValid = [aholder](std::size_t i) { aholder->m_validity[i / 8] |= std::uint8_t(1 << (i % 8)); };
+
+    switch (cd.getDataType())
+    {
+    case DataType::INT:
+        sholder->m_format = "i";
+        aholder->m_ints.resize(n);
+        for (std::size_t i = 0; i < n; ++i)
+        {
+            const Entry& v = table.getValue(i, column);
+            if (v.index() == 1)
+            {
+                aholder->m_ints[i] = std::get<int>(v);
+                setValid(i);
+            }
+            else
+                ++nulls;
+        }
+        aholder->m_buffers = { nullptr, aholder->m_ints.data() };
+        break;
+    case DataType::DOUBLE:
+        sholder->m_format = "g";
+        aholder->m_doubles.resize(n);
+        for (std::size_t i = 0; i < n; ++i)
+        {
+            const Entry& v = table.getValue(i, column);
+            if (v.index() == 3)
+            {
+                aholder->m_doubles[i] = std::get<double>(v);
+                setValid(i);
+            }
+            else if (v.index() == 1)
+            {
+                aholder->m_doubles[i] = std::get<int>(v);
+                setValid(i);
+            }
+            else
+                ++nulls;
+        }
+        aholder->m_buffers = { nullptr, aholder->m_doubles.data() };
+        break;
+    case DataType::TEXT:
+        aholder->m_largeOffsets.push_back(0);
+        for (std::size_t i = 0; i < n; ++i)
+        {
+            const Entry& v = table.getValue(i, column);
+            if (v.index() == 2)
+            {
+                appendText(aholder, std::get<std::string>(v));
+                setValid(i);
+            }
+            else
+            {
+                appendText(aholder, "");
+                ++nulls;
+            }
+        }
+        finishText(sholder, aholder);
+        break;
+    case DataType::SHORT_TEXT:
+    {
+        // int32 codes into a utf8 dictionary of the distinct values
+        sholder->m_format = "i";
+        auto dsholder = new ExportedSchema();
+        auto daholder = new ExportedArray();
+        daholder->m_largeOffsets.push_back(0);
+
+        std::map<std::string, std::int32_t> codes;
+        aholder->m_ints.resize(n);
+        for (std::size_t i = 0; i < n; ++i)
+        {
+            const Entry& v = table.getValue(i, column);
+            if (v.index() != 2)
+            {
+                ++nulls;
+                continue;
+            }
+
+            const std::string& s = std::get<std::string>(v);
+            auto search = codes.find(s);
+            if (search == codes.end())
+            {
+                search = codes.emplace(s, std::int32_t(codes.size())).first;
+                appendText(daholder, s);
+            }
+            aholder->m_ints[i] = search->second;
+            setValid(i);
+        }
+
+        finishText(dsholder, daholder);
+        sholder->m_dictionary = new ArrowSchema();
+        fillSchema(sholder->m_dictionary, dsholder, ARROW_FLAG_NULLABLE);
+        aholder->m_dictionary = new ArrowArray();
+        fillArray(aholder->m_dictionary, daholder, std::int64_t(codes.size()), 0);
+        aholder->m_buffers = { nullptr, aholder->m_ints.data() };
+        break;
+    }
+    }
+
+    if (nulls > 0)
+        aholder->m_buffers[0] = aholder->m_validity.data();
+
+    fillSchema(schema, sholder, ARROW_FLAG_NULLABLE);
+    fillArray(array, aholder, std::int64_t(n), nulls);
+}
+
+void Tabular::exportArrow(ArrowSchema* schema, ArrowArray* array) const
+{
+    auto sholder = new ExportedSchema();
+    sholder->m_format = "+s";
+    auto aholder = new ExportedArray();
+    aholder->m_buffers = { nullptr };
+
+    for (std::size_t j = 0; j < nCols(); ++j)
+    {
+        sholder->m_children.push_back(new ArrowSchema());
+        aholder->m_children.push_back(new ArrowArray());
+        exportColumn(*this, j, sholder->m_children.back(), aholder->m_children.back());
+    }
+
+    fillSchema(schema, sholder, 0);
+    fillArray(array, aholder, std::int64_t(nRows()), 0);
+}
+
+const PT Tabular::createFromArrow(ArrowSchema* schema, ArrowArray* array)
+{
+    return std::make_shared<ArrowTable>(schema, array);
+}
+
+ArrowTable::ArrowTable(ArrowSchema* schema, ArrowArray* array)
+{
+    // moving a struct is a shallow copy and marking the source released
+    m_cschema = std::shared_ptr<ArrowSchema>(new ArrowSchema(*schema), [](ArrowSchema* s) {
+        if (s->release)
+            s->release(s);
+        delete s;
+    });
+    schema->release = nullptr;
+
+    m_carray = std::shared_ptr<ArrowArray>(new ArrowArray(*array), [](ArrowArray* a) {
+        if (a->release)
+            a->release(a);
+        delete a;
+    });
+    array->release = nullptr;
+
+    if (std::strcmp(m_cschema->format, "+s") != 0 || m_cschema->n_children != m_carray->n_children)
+        throw std::invalid_argument("arrow import expects a struct array");
+    if (m_carray->length < 0 || m_carray->offset < 0)
+        throw std::invalid_argument("arrow struct array has a negative length or offset");
+
+    std::vector<ColumnDefinition> defs;
+    for (std::int64_t i = 0; i < m_cschema->n_children; ++i)
+    {
+        const ArrowSchema* cs = m_cschema->children[i];
+        const ArrowArray* ca = m_carray->children[i];
+        if (ca == nullptr || ca->offset < 0 || ca->length < m_carray->offset + m_carray->length)
+            throw std::invalid_argument("arrow child array is shorter than its struct");
+
+        auto c = std::make_unique<Column>();
+        c->m_array = ca;
+        c->m_offset = m_carray->offset + c->m_array->offset;
+        c->m_indexFormat = 0;
+        c->m_large = false;
+
+        std::string format(cs->format);
+        if (cs->dictionary)
+        {
+            std::string values(cs->dictionary->format);
+            if ((values != "u" && values != "U") || format.size() != 1 || std::string("csil").find(format[0]) == std::string::npos)
+                throw std::invalid_argument("unsupported arrow dictionary " + format + ":" + values);
+            c->m_dt = DataType::SHORT_TEXT;
+            c->m_indexFormat = format[0];
+            c->m_large = values == "U";
+        }
+        else if (format == "i")
+            c->m_dt = DataType::INT;
+        else if (format == "g")
+            c->m_dt = DataType::DOUBLE;
+        else if (format == "u" || format == "U")
+        {
+            c->m_dt = DataType::TEXT;
+            c->m_large = format == "U";
+        }
+        else
+            throw std::invalid_argument("unsupported arrow format " + format);
+
+        validate(*c);
+        defs.push_back(ColumnDefinition(cs->name ? cs->name : "", c->m_dt));
+        m_cols.push_back(std::move(c));
+    }
+
+    m_schema = Schema(defs);
+}
+
+// buffer sizes are not part of the interface, what can be checked is
+// that every buffer we read is there and offsets and codes are in range
+void ArrowTable::validate(const Column& c) const
+{
+    std::int64_t n = m_carray->length;
+    const ArrowArray* a = c.m_array;
+
+    auto buffers = [](const ArrowArray* array, std::int64_t expected) {
+        if (array->n_buffers != expected || array->buffers == nullptr)
+            throw std::invalid_argument("arrow array has the wrong number of buffers");
+        if (array->buffers[1] == nullptr && array->length > 0)
+            throw std::invalid_argument("arrow array is missing a data buffer");
+    };
+
+    // offsets of rows [begin, end) must not decrease, the characters
+    // may only be missing when every string is empty
+    auto offsets = [](const ArrowArray* array, std::int64_t begin, std::int64_t end, bool large) {
+        if (end == begin)
+            return;
+
+        std::int64_t first = 0, last = 0;
+        for (std::int64_t r = begin; r <= end; ++r)
+        {
+            std::int64_t o = large ? static_cast<const std::int64_t*>(array->buffers[1])[r]
+                : static_cast<const std::int32_t*>(array->buffers[1])[r];
+            if (o < 0 || (r > begin && o < last))
+                throw std::invalid_argument("arrow utf8 offsets are out of order");
+            if (r == begin)
+                first = o;
+            last = o;
+        }
+
+        if (array->buffers[2] == nullptr && last != first)
+            throw std::invalid_argument("arrow utf8 array is missing its characters");
+    };
+
+    switch (c.m_dt)
+    {
+    case DataType::INT:
+    case DataType::DOUBLE:
+        buffers(a, 2);
+        break;
+    case DataType::TEXT:
+        buffers(a, 3);
+        offsets(a, c.m_offset, c.m_offset + n, c.m_large);
+        break;
+    case DataType::SHORT_TEXT:
+    {
+        buffers(a, 2);
+        const ArrowArray* d = a->dictionary;
+        if (d == nullptr || d->length < 0 || d->offset < 0)
+            throw std::invalid_argument("arrow dictionary array is missing");
+        buffers(d, 3);
+        offsets(d, d->offset, d->offset + d->length, c.m_large);
+
+        for (std::int64_t row = 0; row < n; ++row)
+        {
+            if (!valid(c, std::size_t(row)))
+                continue;
+            auto code = this->code(c, c.m_offset + row);
+            if (code < 0 || code >= d->length)
+                throw std::invalid_argument("arrow dictionary code out of range");
+        }
+        break;
+    }
+    }
+}
+
+bool ArrowTable::valid(const Column& c, std::size_t row) const
+{
+    auto bits = static_cast<const std::uint8_t*>(c.m_array->buffers[0]);
+    if (bits == nullptr)
+        return true;
+
+    auto p = c.m_offset + std::int64_t(row);
+    return (bits[p / 8] >> (p % 8)) & 1;
+}
+
+const std::string ArrowTable::text(const ArrowArray* array, std::int64_t row, bool large) const
+{
+    auto chars = static_cast<const char*>(array->buffers[2]);
+    if (chars == nullptr)
+        return std::string();
+    if (large)
+    {
+        auto offsets = static_cast<const std::int64_t*>(array->buffers[1]);
+        return std::string(chars + offsets[row], chars + offsets[row + 1]);
+    }
+
+    auto offsets = static_cast<const std::int32_t*>(array->buffers[1]);
+    return std::string(chars + offsets[row], chars + offsets[row + 1]);
+}
+
+const Entry ArrowTable::s_null;
+
+const std::int64_t ArrowTable::code(const Column& c, std::int64_t p) const
+{
+    const void* codes = c.m_array->buffers[1];
+    switch (c.m_indexFormat)
+    {
+    case 'c': return static_cast<const std::int8_t*>(codes)[p];
+    case 's': return static_cast<const std::int16_t*>(codes)[p];
+    case 'i': return static_cast<const std::int32_t*>(codes)[p];
+    default: return static_cast<const std::int64_t*>(codes)[p];
+    }
+}
+
+void ArrowTable::decode(Column& c) const
+{
+    // the distinct values only, as a ColumnShard's store holds them
+    if (c.m_dt == DataType::SHORT_TEXT)
+    {
+        const ArrowArray* dictionary = c.m_array->dictionary;
+        c.m_entries.reserve(std::size_t(dictionary->length));
+        for (std::int64_t k = 0; k < dictionary->length; ++k)
+            c.m_entries.push_back(Entry(text(dictionary, dictionary->offset + k, c.m_large)));
+        return;
+    }
+
+    std::size_t n = nRows();
+    c.m_entries.reserve(n);
+    for (std::size_t row = 0; row < n; ++row)
+    {
+        if (!valid(c, row))
+        {
+            c.m_entries.push_back(std::monostate());
+            continue;
+        }
+
+        auto p = c.m_offset + std::int64_t(row);
+        switch (c.m_dt)
+        {
+        case DataType::INT:
+            c.m_entries.push_back(Entry(static_cast<const std::int32_t*>(c.m_array->buffers[1])[p]));
+            break;
+        case DataType::DOUBLE:
+            c.m_entries.push_back(Entry(static_cast<const double*>(c.m_array->buffers[1])[p]));
+            break;
+        case DataType::TEXT:
+            c.m_entries.push_back(Entry(text(c.m_array, p, c.m_large)));
+            break;
+        case DataType::SHORT_TEXT:
+            break;
+        }
+    }
+}
+
+const Entry& ArrowTable::getValue(std::size_t row, std::size_t column) const
+{
+    Column& c = *m_cols[column];
+    std::call_once(c.m_decoded, [this, &c]() { decode(c); });
+    if (c.m_dt != DataType::SHORT_TEXT)
+        return c.m_entries[row];
+
+    if (!valid(c, row))
+        return s_null;
+    return c.m_entries[std::size_t(code(c, c.m_offset + std::int64_t(row)))];
+}
+
+const void* ArrowTable::values(std::size_t column) const
+{
+    const Column& c = *m_cols[column];
+    switch (c.m_dt)
+    {
+    case DataType::INT:
+        return static_cast<const std::int32_t*>(c.m_array->buffers[1]) + c.m_offset;
+    case DataType::DOUBLE:
+        return static_cast<const double*>(c.m_array->buffers[1]) + c.m_offset;
+    default:
+        return nullptr;
+    }
+}
+
+bool ArrowTable::isNull(std::size_t row, std::size_t column) const
+{
+    return !valid(*m_cols[column], row);
+}
@@ -0,0 +1,101 @@
+#pragma once
+
+#include <cstdint>
+
+#include "tabular.h"
+
+// Arrow C data interface, ABI as published by the Arrow project
+// https://arrow.apache.org/docs/format/CDataInterface.html
+#ifndef ARROW_C_DATA_INTERFACE
+#define ARROW_C_DATA_INTERFACE
+
+#define ARROW_FLAG_DICTIONARY_ORDERED 1
+#define ARROW_FLAG_NULLABLE 2
+#define ARROW_FLAG_MAP_KEYS_SORTED 4
+
+struct ArrowSchema {
+    const char* format;
+    const char* name;
+    const char* metadata;
+    int64_t flags;
+    int64_t n_children;
+    struct ArrowSchema** children;
+    struct ArrowSchema* dictionary;
+
+    void (*release)(struct ArrowSchema*);
+    void* private_data;
+};
+
+struct ArrowArray {
+    int64_t length;
+    int64_t null_count;
+    int64_t offset;
+    int64_t n_buffers;
+    int64_t n_children;
+    const void** buffers;
+    struct ArrowArray** children;
+    struct ArrowArray* dictionary;
+
+    void (*release)(struct ArrowArray*);
+    void* private_data;
+};
+
+#endif
+
+// a struct array ("+s") viewed as a table, one column per child
+// the foreign buffers are used in place and released with the table
+// supported children: int32 -> INT, float64 -> DOUBLE, utf8 -> TEXT,
+// dictionary encoded utf8 -> SHORT_TEXT
+class ArrowTable : public Tabular
+{
+private:
+    struct Column
+    {
+        const ArrowArray* m_array;
+        std::int64_t m_offset;
+        DataType m_dt;
+        char m_indexFormat;
+        bool m_large;
+
+        // Entry view of the column, decoded on first generic access
+        // dictionary columns only decode the dictionary, rows read codes
+        std::once_flag m_decoded;
+        std::vector<Entry> m_entries;
+    };
+
+    static const Entry s_null;
+
+    std::shared_ptr<ArrowSchema> m_cschema;
+    std::shared_ptr<ArrowArray> m_carray;
+    std::vector<std::unique_ptr<Column>> m_cols;
+    Schema m_schema;
+
+    // throws std::invalid_argument on anything we could read out of bounds
+    void validate(const Column& c) const;
+    bool valid(const Column& c, std::size_t row) const;
+    const std::int64_t code(const Column& c, std::int64_t p) const;
+    const std::string text(const ArrowArray* array, std::int64_t row, bool large) const;
+    void decode(Column& c) const;
+
+public:
+    // takes ownership of both structs, the caller's copies are marked released
+    ArrowTable(ArrowSchema* schema, ArrowArray* array);
+
+    const Schema& getSchema() const
+    {
+        return m_schema;
+    }
+
+    const std::size_t nRows() const
+    {
+        return std::size_t(m_carray->length);
+    }
+
+    virtual const Entry& getValue(std::size_t row, std::size_t column) const;
+
+    // the raw int32 / float64 values of INT and DOUBLE columns, offset to
+    // row 0, nullptr for other columns, for callers which want to skip
+    // the Entry view, the operators themselves all read through getValue
+    const void* values(std::size_t column) const;
+    bool isNull(std::size_t row, std::size_t column) const;
+};
@@ -0,0 +1,225 @@
+#include "bitmap.h"
+
+void RowBitmap::Container::add(std::uint16_t low)
+{
+    if (isBitmap())
+    {
+        std::uint64_t& word = m_bits[low >> 6];
+        std::uint64_t bit = std::uint64_t(1) << (low & 63);
+        if (!(word & bit))
+        {
+            word |= bit;
+            ++m_cardinality;
+        }
+        return;
+    }
+
+    if (m_array.empty() || m_array.back() < low)
+    {
+        m_array.push_back(low);
+    }
+    else
+    {
+        auto it = std::lower_bound(m_array.begin(), m_array.end(), low);
+        if (*it == low)
+            return;
+        m_array.insert(it, low);
+    }
+
+    ++m_cardinality;
+    if (m_cardinality > ARRAY_LIMIT)
+        toBitmap();
+}
+
+bool RowBitmap::Container::contains(std::uint16_t low) const
+{
+    if (isBitmap())
+        return (m_bits[low >> 6] >> (low & 63)) & 1;
+    else
+        return std::binary_search(m_array.begin(), m_array.end(), low);
+}
+
+void RowBitmap::Container::toBitmap()
+{
+    m_bits.assign(BITMAP_WORDS, 0);
+    for (auto low : m_array)
+        m_bits[low >> 6] |= std::uint64_t(1) << (low & 63);
+    m_array.clear();
+    m_array.shrink_to_fit();
+}
+
+void RowBitmap::Container::toArray()
+{
+    m_array.clear();
+    m_array.reserve(m_cardinality);
+    for (std::size_t w = 0; w < BITMAP_WORDS; ++w)
+    {
+        for (std::uint64_t word = m_bits[w]; word != 0; word &= word - 1)
+            m_array.push_back(std::uint16_t(w * 64 + std::countr_zero(word)));
+    }
+    m_bits.clear();
+    m_bits.shrink_to_fit();
+}
+
+RowBitmap::Container RowBitmap::Container::intersect(const Container& a, const Container& b)
+{
+    Container out;
+    if (a.isBitmap() && b.isBitmap())
+    {
+        out.m_bits.resize(BITMAP_WORDS);
+        for (std::size_t w = 0; w < BITMAP_WORDS; ++w)
+        {
+            out.m_bits[w] = a.m_bits[w] & b.m_bits[w];
+            out.m_cardinality += std::popcount(out.m_bits[w]);
+        }
+        if (out.m_cardinality <= ARRAY_LIMIT)
+            out.toArray();
+    }
+    else if (a.isBitmap() || b.isBitmap())
+    {
+        const Container& dense = a.isBitmap() ? a : b;
+        const Container& sparse = a.isBitmap() ? b : a;
+        std::copy_if(sparse.m_array.begin(), sparse.m_array.end(), std::back_inserter(out.m_array),
+            [&dense](std::uint16_t low) -> bool { return dense.contains(low); });
+        out.m_cardinality = out.m_array.size();
+    }
+    else
+    {
+        std::set_intersection(a.m_array.begin(), a.m_array.end(), b.m_array.begin(), b.m_array.end(),
+            std::back_inserter(out.m_array));
+        out.m_cardinality = out.m_array.size();
+    }
+    return out;
+}
+
+RowBitmap::Container RowBitmap::Container::unite(const Container& a, const Container& b)
+{
+    Container out;
+    if (a.isBitmap() || b.isBitmap())
+    {
+        out = a.isBitmap() ? a : b;
+        const Container& other = a.isBitmap() ? b : a;
+        if (other.isBitmap())
+        {
+            out.m_cardinality = 0;
+            for (std::size_t w = 0; w < BITMAP_WORDS; ++w)
+            {
+                out.m_bits[w] |= other.m_bits[w];
+                out.m_cardinality += std::popcount(out.m_bits[w]);
+            }
+        }
+        else
+        {
+            for (auto low : other.m_array)
+                out.add(low);
+        }
+    }
+    else
+    {
+        std::set_union(a.m_array.begin(), a.m_array.end(), b.m_array.begin(), b.m_array.end(),
+            std::back_inserter(out.m_array));
+        out.m_cardinality = out.m_array.size();
+        if (out.m_cardinality > ARRAY_LIMIT)
+            out.toBitmap();
+    }
+    return out;
+}
+
+void RowBitmap::add(std::uint32_t row)
+{
+    std::uint16_t high = std::uint16_t(row >> 16);
+    std::uint16_t low = std::uint16_t(row & 0xFFFF);
+
+    if (m_keys.empty() || m_keys.back() < high)
+    {
+        m_keys.push_back(high);
+        m_containers.emplace_back();
+        m_containers.back().add(low);
+        return;
+    }
+
+    auto it = std::lower_bound(m_keys.begin(), m_keys.end(), high);
+    auto k = std::distance(m_keys.begin(), it);
+    if (*it != high)
+    {
+        m_keys.insert(it, high);
+        m_containers.insert(m_containers.begin() + k, Container());
+    }
+    m_containers[k].add(low);
+}
+
+bool RowBitmap::contains(std::uint32_t row) const
+{
+    std::uint16_t high = std::uint16_t(row >> 16);
+    auto it = std::lower_bound(m_keys.begin(), m_keys.end(), high);
+    if (it == m_keys.end() || *it != high)
+        return false;
+
+    return m_containers[std::distance(m_keys.begin(), it)].contains(std::uint16_t(row & 0xFFFF));
+}
+
+const std::size_t RowBitmap::cardinality() const
+{
+    std::size_t n = 0;
+    for (const Container& c : m_containers)
+        n += c.m_cardinality;
+    return n;
+}
+
+const RowBitmap RowBitmap::operator&(const RowBitmap& other) const
+{
+    RowBitmap out;
+    std::size_t i = 0, j = 0;
+    while (i < m_keys.size() && j < other.m_keys.size())
+    {
+        if (m_keys[i] < other.m_keys[j])
+            ++i;
+        else if (other.m_keys[j] < m_keys[i])
+            ++j;
+        else
+        {
+            Container c = Container::intersect(m_containers[i], other.m_containers[j]);
+            if (c.m_cardinality > 0)
+            {
+                out.m_keys.push_back(m_keys[i]);
+                out.m_containers.push_back(std::move(c));
+            }
+            ++i;
+            ++j;
+        }
+    }
+    return out;
+}
+
+const RowBitmap RowBitmap::operator|(const RowBitmap& other) const
+{
+    RowBitmap out;
+    std::size_t i = 0, j = 0;
+    while (i < m_keys.size() || j < other.m_keys.size())
+    {
+        if (j == other.m_keys.size() || (i < m_keys.size() && m_keys[i] < other.m_keys[j]))
+        {
+            out.m_keys.push_back(m_keys[i]);
+            out.m_containers.push_back(m_containers[i++]);
+        }
+        else if (i == m_keys.size() || other.m_keys[j] < m_keys[i])
+        {
+            out.m_keys.push_back(other.m_keys[j]);
+            out.m_containers.push_back(other.m_containers[j++]);
+        }
+        else
+        {
+            out.m_keys.push_back(m_keys[i]);
+            out.m_containers.push_back(Container::unite(m_containers[i++], other.m_containers[j++]));
+        }
+    }
+    return out;
+}
+
+const std::vector<std::size_t> RowBitmap::rows() const
+{
+    std::vector<std::size_t> output;
+    output.reserve(cardinality());
+    forEach([&output](std::size_t row) { output.push_back(row); });
+    return output;
+}
@@ -0,0 +1,84 @@
+#pragma once
+
+#include <bit>
+#include <cstdint>
+
+#include "central.h"
+
+// roaring-style compressed set of row numbers
+// rows are split on their high 16 bits into containers, each container
+// holds the low 16 bits either as a sorted array (sparse) or as a
+// fixed 65536 bit bitmap (dense)
+class RowBitmap
+{
+private:
+    static const std::size_t ARRAY_LIMIT = 4096;
+    static const std::size_t BITMAP_WORDS = 1024;
+
+    struct Container
+    {
+        std::vector<std::uint16_t> m_array;
+        std::vector<std::uint64_t> m_bits;
+        std::size_t m_cardinality = 0;
+
+        bool isBitmap() const
+        {
+            return !m_bits.empty();
+        }
+
+        void add(std::uint16_t low);
+        bool contains(std::uint16_t low) const;
+        void toBitmap();
+        void toArray();
+
+        static Container intersect(const Container& a, const Container& b);
+        static Container unite(const Container& a, const Container& b);
+    };
+
+    std::vector<std::uint16_t> m_keys;
+    std::vector<Container> m_containers;
+
+public:
+    RowBitmap()
+    {}
+
+    // cheapest when rows arrive in ascending order
+    void add(std::uint32_t row);
+    bool contains(std::uint32_t row) const;
+
+    const std::size_t cardinality() const;
+
+    bool empty() const
+    {
+        return m_keys.empty();
+    }
+
+    const RowBitmap operator&(const RowBitmap& other) const;
+    const RowBitmap operator|(const RowBitmap& other) const;
+
+    // ascending row numbers
+    const std::vector<std::size_t> rows() const;
+
+    template<typename F>
+    void forEach(F f) const
+    {
+        for (std::size_t k = 0; k < m_keys.size(); ++k)
+        {
+            std::size_t high = std::size_t(m_keys[k]) << 16;
+            const Container& c = m_containers[k];
+            if (c.isBitmap())
+            {
+                for (std::size_t w = 0; w < BITMAP_WORDS; ++w)
+                {
+                    for (std::uint64_t word = c.m_bits[w]; word != 0; word &= word - 1)
+                        f(high | (w * 64 + std::countr_zero(word)));
+                }
+            }
+            else
+            {
+                for (auto low : c.m_array)
+                    f(high | low);
+            }
+        }
+    }
+};
@@ -0,0 +1,135 @@
+#include "bloom.h"
+
+// the odd constants of the parquet split block filter, one per word
+static const std::uint32_t SALTS[8] = {
+    0x47b6137bU, 0x44974d91U, 0x8824ad5bU, 0xa2b7289dU,
+    0x705495c7U, 0x2df1424bU, 0x9efc4947U, 0x5c6bfb31U
+};
+
+BloomFilter::BloomFilter(std::size_t expected, std::size_t bitsPerKey) :
+    m_blocks(std::max<std::size_t>(1, expected * bitsPerKey / (BLOCK_WORDS * 64)))
+{
+    m_words.resize(m_blocks * BLOCK_WORDS);
+}
+
+// std::hash of small ints is the int itself, spread it over all bits
+std::uint64_t BloomFilter::mix(std::size_t hash)
+{
+    std::uint64_t h = hash;
+    h ^= h >> 30;
+    h *= 0xbf58476d1ce4e5b9ULL;
+    h ^= h >> 27;
+    h *= 0x94d049bb133111ebULL;
+    h ^= h >> 31;
+    return h;
+}
+
+const std::size_t BloomFilter::block(std::uint64_t h) const
+{
+    return std::size_t(((h >> 32) * m_blocks) >> 32);
+}
+
+std::uint64_t BloomFilter::mask(std::uint64_t h, std::size_t word)
+{
+    return std::uint64_t(1) << ((std::uint32_t(h) * SALTS[word]) >> 26);
+}
+
+void BloomFilter::add(std::size_t hash)
+{
+    auto h = mix(hash);
+    std::uint64_t* words = m_words.data() + block(h) * BLOCK_WORDS;
+    for (std::size_t w = 0; w < BLOCK_WORDS; ++w)
+        words[w] |= mask(h, w);
+}
+
+bool BloomFilter::mayContain(std::size_t hash) const
+{
+    auto h = mix(hash);
+    const std::uint64_t* words = m_words.data() + block(h) * BLOCK_WORDS;
+    for (std::size_t w = 0; w < BLOCK_WORDS; ++w)
+    {
+        if ((words[w] & mask(h, w)) == 0)
+            return false;
+    }
+    return true;
+}
+
+RuntimeFilter::RuntimeFilter(const PT& build, const std::vector<std::size_t>& columns) :
+    m_bloom(build->nRows())
+{
+    if (columns.size() == 1)
+        m_range = std::pair(Entry(), Entry());
+
+    ES key(columns.size());
+    for (std::size_t i = 0; i < build->nRows(); ++i)
+    {
+        for (std::size_t k = 0; k < columns.size(); ++k)
+            key[k] = build->getValue(i, columns[k]);
+        m_bloom.add(Index::hash(key));
+
+        if (m_range && key[0].index() != 0)
+        {
+            auto& range = *m_range;
+            if (range.first.index() == 0 || key[0] < range.first)
+                range.first = key[0];
+            if (range.second.index() == 0 || range.second < key[0])
+                range.second = key[0];
+        }
+    }
+}
+
+RuntimeFilter::RuntimeFilter(const BitmapIndex& index) :
+    m_bloom(index.bitmaps().size()), m_range(std::pair(Entry(), Entry()))
+{
+    // keys come in order, monostate first
+    for (const auto& b : index.bitmaps())
+    {
+        m_bloom.add(Index::hash(ES({ b.first })));
+        if (b.first.index() == 0)
+            continue;
+        if (m_range->first.index() == 0)
+            m_range->first = b.first;
+        m_range->second = b.first;
+    }
+}
+
+bool RuntimeFilter::mayMatch(const ES& key) const
+{
+    // nulls are not tracked by the range, but do join with each other
+    if (m_range && key[0].index() != 0)
+    {
+        const auto& range = *m_range;
+        if (range.first.index() == 0 || key[0] < range.first || range.second < key[0])
+            return false;
+    }
+
+    return m_bloom.mayContain(Index::hash(key));
+}
+
+const std::optional<std::vector<std::uint64_t>> RuntimeFilter::scan(const PT& probe, const std::vector<std::size_t>& columns,
+    Reservation& reservation) const
+{
+    std::vector<std::uint64_t> rows;
+    ES key(columns.size());
+    for (std::size_t i = 0; i < probe->nRows(); ++i)
+    {
+        for (std::size_t k = 0; k < columns.size(); ++k)
+            key[k] = probe->getValue(i, columns[k]);
+        if (mayMatch(key))
+        {
+            if (rows.size() == rows.capacity())
+            {
+                std::size_t extra = std::max<std::size_t>(rows.capacity(), 1024);
+                if (!reservation.grow(extra * sizeof(std::uint64_t)))
+                    return std::nullopt;
+                rows.reserve(rows.capacity() + extra);
+            }
+            rows.push_back(i);
+        }
+
+        // most rows pass, the join is better off without a second look at them
+        if (i + 1 == SAMPLE_ROWS && rows.size() * 4 > SAMPLE_ROWS * 3)
+            return std::nullopt;
+    }
+    return rows;
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <cstdint>
+
+#include "tabular.h"
+
+// split block bloom filter, every key sets one bit in each of the eight
+// words of a single 64 byte block, so a probe touches one cache line
+class BloomFilter
+{
+private:
+    static const std::size_t BLOCK_WORDS = 8;
+
+    std::vector<std::uint64_t> m_words;
+    std::size_t m_blocks;
+
+    const std::size_t block(std::uint64_t h) const;
+    static std::uint64_t mask(std::uint64_t h, std::size_t word);
+    static std::uint64_t mix(std::size_t hash);
+
+public:
+    // about 1% false positives at the default bits per key
+    BloomFilter(std::size_t expected, std::size_t bitsPerKey = 10);
+
+    void add(std::size_t hash);
+    bool mayContain(std::size_t hash) const;
+};
+
+// what a join build side knows about its keys, to drop probe rows early:
+// a bloom filter over Index::hash of every key, and for single column keys
+// the smallest and largest non null key
+class RuntimeFilter
+{
+private:
+    // probe rows looked at before deciding whether filtering pays
+    static const std::size_t SAMPLE_ROWS = 4096;
+
+    BloomFilter m_bloom;
+
+    // single column keys only, a pair of monostates when every key is null
+    std::optional<std::pair<Entry, Entry>> m_range;
+
+public:
+    RuntimeFilter(const PT& build, const std::vector<std::size_t>& columns);
+
+    // from the distinct keys of a persistent index, without a scan
+    RuntimeFilter(const BitmapIndex& index);
+
+    bool mayMatch(const ES& key) const;
+
+    // probe rows which may find a partner, in row order
+    // empty when too many pass for the filter to be worth it, checked
+    // on a leading sample of the rows, or when reservation cannot hold them
+    const std::optional<std::vector<std::uint64_t>> scan(const PT& probe, const std::vector<std::size_t>& columns,
+        Reservation& reservation) const;
+};
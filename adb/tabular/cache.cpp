@@ -0,0 +1,98 @@
+#include "cache.h"
+
+ResultCache& ResultCache::global()
+{
+    static ResultCache cache;
+    return cache;
+}
+
+void ResultCache::evict()
+{
+    while (m_used > m_capacity && !m_ages.empty())
+    {
+        auto slot = m_slots.find(m_ages.back());
+        m_used -= slot->second.bytes;
+        m_slots.erase(slot);
+        m_ages.pop_back();
+    }
+}
+
+void ResultCache::setCapacity(std::size_t capacity)
+{
+    std::lock_guard<std::mutex> lock(m_lock);
+    m_capacity = capacity;
+    evict();
+}
+
+void ResultCache::clear()
+{
+    std::lock_guard<std::mutex> lock(m_lock);
+    m_slots.clear();
+    m_ages.clear();
+    m_used = 0;
+}
+
+const std::size_t ResultCache::capacity() const
+{
+    std::lock_guard<std::mutex> lock(m_lock);
+    return m_capacity;
+}
+
+const std::size_t ResultCache::used() const
+{
+    std::lock_guard<std::mutex> lock(m_lock);
+    return m_used;
+}
+
+const std::size_t ResultCache::hits() const
+{
+    std::lock_guard<std::mutex> lock(m_lock);
+    return m_hits;
+}
+
+const std::size_t ResultCache::misses() const
+{
+    std::lock_guard<std::mutex> lock(m_lock);
+    return m_misses;
+}
+
+const PT ResultCache::find(const std::string& fingerprint)
+{
+    std::lock_guard<std::mutex> lock(m_lock);
+    auto slot = m_slots.find(fingerprint);
+    if (slot == m_slots.end())
+    {
+        ++m_misses;
+        return nullptr;
+    }
+
+    ++m_hits;
+    m_ages.splice(m_ages.begin(), m_ages, slot->second.age);
+    return slot->second.result;
+}
+
+const PT ResultCache::insert(const std::string& fingerprint, const PT& result)
+{
+    // the cells alone do not fit, not worth materializing
+    if (result->nRows() * result->nCols() * sizeof(Entry) + 2 * fingerprint.size() > capacity())
+        return result;
+
+    // outside the lock, this is the expensive part
+    PT table = result->materialize();
+
+    // with the text, the key is held twice
+    std::size_t bytes = std::dynamic_pointer_cast<const Table0>(table)->bytes() + 2 * fingerprint.size();
+    if (bytes > capacity())
+        return table;
+
+    std::lock_guard<std::mutex> lock(m_lock);
+    auto existing = m_slots.find(fingerprint);
+    if (existing != m_slots.end())
+        return existing->second.result;
+
+    m_ages.push_front(fingerprint);
+    m_slots.emplace(fingerprint, Slot{ table, bytes, m_ages.begin() });
+    m_used += bytes;
+    evict();
+    return table;
+}
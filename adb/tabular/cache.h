@@ -0,0 +1,71 @@
+#pragma once
+
+#include <list>
+#include <unordered_map>
+
+#include "tabular.h"
+
+// materialized results of joins, groupBys and filters keyed by their
+// fingerprint, so the same query over the same base tables is computed
+// once, the least recently used results are dropped to stay under the
+// capacity in bytes, a capacity of 0 turns the cache off
+class ResultCache
+{
+private:
+    struct Slot
+    {
+        PT result;
+        std::size_t bytes;
+        std::list<std::string>::iterator age;
+    };
+
+    mutable std::mutex m_lock;
+    std::size_t m_capacity;
+    std::size_t m_used = 0;
+    std::size_t m_hits = 0;
+    std::size_t m_misses = 0;
+
+    // most recently used first
+    std::list<std::string> m_ages;
+    std::unordered_map<std::string, Slot> m_slots;
+
+    // callers hold m_lock
+    void evict();
+
+public:
+    ResultCache(std::size_t capacity = 0) :
+        m_capacity(capacity)
+    {}
+
+    // the cache Tabular::join, groupBy and filter go through, off by default
+    static ResultCache& global();
+
+    void setCapacity(std::size_t capacity);
+    void clear();
+
+    const std::size_t capacity() const;
+    const std::size_t used() const;
+    const std::size_t hits() const;
+    const std::size_t misses() const;
+
+    bool enabled() const
+    {
+        return capacity() > 0;
+    }
+
+    // nullptr when nothing is cached under the fingerprint
+    const PT find(const std::string& fingerprint);
+
+    // materializes result and keeps it, unless it alone exceeds the
+    // capacity, text included, returns what callers should use in place
+    // of result
+    const PT insert(const std::string& fingerprint, const PT& result);
+
+    // concurrent misses on one fingerprint may each build it
+    template<typename F>
+    const PT fetch(const std::string& fingerprint, F build)
+    {
+        PT hit = find(fingerprint);
+        return hit ? hit : insert(fingerprint, build());
+    }
+};
@@ -0,0 +1,389 @@
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+#include "cluster.h"
+#include "cache.h"
+#include "export.h"
+#include "partition.h"
+
+static const std::string encode(const PT& table)
+{
+    std::ostringstream out;
+    BinaryWriter(out).write(table);
+    return out.str();
+}
+
+static const PT decode(const std::string& bytes)
+{
+    std::istringstream in(bytes);
+    return BinaryReader(in).read();
+}
+
+#ifndef _WIN32
+
+// a transfer broke off because the other end went away, in a worker
+// that is usually fallout from a failure elsewhere
+class PeerLost : public std::runtime_error
+{
+public:
+    PeerLost(const std::string& what) :
+        std::runtime_error(what)
+    {}
+};
+
+// one length prefixed message to and/or from each socket, -1 is skipped
+// all sockets are served together through poll, so processes sending
+// each other large tables at the same time can never block one another
+static std::vector<std::string> transfer(const std::vector<int>& sockets,
+    const std::vector<std::string>& outgoing, bool sending, bool receiving)
+{
+    struct Link
+    {
+        int fd;
+        std::string out;
+        std::size_t sent = 0;
+        bool sending = false;
+
+        char header[8];
+        std::uint64_t length = 0;
+        std::size_t got = 0;
+        std::string in;
+        bool receiving = false;
+    };
+
+    std::vector<Link> links(sockets.size());
+    for (std::size_t i = 0; i < sockets.size(); ++i)
+    {
+        Link& l = links[i];
+        l.fd = sockets[i];
+        if (l.fd < 0)
+            continue;
+
+        fcntl(l.fd, F_SETFL, fcntl(l.fd, F_GETFL) | O_NONBLOCK);
+        if (sending)
+        {
+            std::uint64_t length = outgoing[i].size();
+            l.out.append(reinterpret_cast<const char*>(&length), sizeof(length));
+            l.out.append(outgoing[i]);
+            l.sending = true;
+        }
+        l.receiving = receiving;
+    }
+
+    while (true)
+    {
+        std::vector<pollfd> fds;
+        std::vector<std::size_t> which;
+        for (std::size_t i = 0; i < links.size(); ++i)
+        {
+            const Link& l = links[i];
+            if (!l.sending && !l.receiving)
+                continue;
+            fds.push_back({ l.fd, short((l.sending ? POLLOUT : 0) | (l.receiving ? POLLIN : 0)), 0 });
+            which.push_back(i);
+        }
+
+        if (fds.empty())
+            break;
+
+        if (poll(fds.data(), fds.size(), -1) < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            throw std::runtime_error("poll failed during transfer");
+        }
+
+        for (std::size_t k = 0; k < fds.size(); ++k)
+        {
+            Link& l = links[which[k]];
+            short revents = fds[k].revents;
+
+            if (l.sending && (revents & POLLOUT))
+            {
+                auto n = send(l.fd, l.out.data() + l.sent, l.out.size() - l.sent, MSG_NOSIGNAL);
+                if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK)
+                    throw PeerLost("peer went away during transfer");
+                if (n > 0)
+                    l.sent += n;
+                if (l.sent == l.out.size())
+                {
+                    l.sending = false;
+                    l.out = {};
+                }
+            }
+
+            if (l.receiving && (revents & (POLLIN | POLLHUP | POLLERR)))
+            {
+                ssize_t n;
+                if (l.got < sizeof(l.header))
+                    n = recv(l.fd, l.header + l.got, sizeof(l.header) - l.got, 0);
+                else
+                    n = recv(l.fd, l.in.data() + (l.got - sizeof(l.header)), l.length - (l.got - sizeof(l.header)), 0);
+
+                if (n == 0)
+                    throw PeerLost("peer closed before its table arrived");
+                if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK)
+                    throw PeerLost("peer went away during transfer");
+
+                if (n > 0)
+                {
+                    bool hadHeader = l.got >= sizeof(l.header);
+                    l.got += n;
+                    if (!hadHeader && l.got == sizeof(l.header))
+                    {
+                        std::memcpy(&l.length, l.header, sizeof(l.length));
+                        l.in.resize(l.length);
+                    }
+                    if (l.got == sizeof(l.header) + l.length)
+                        l.receiving = false;
+                }
+            }
+            else if (l.sending && (revents & (POLLHUP | POLLERR | POLLNVAL)))
+            {
+                throw PeerLost("peer went away during transfer");
+            }
+        }
+    }
+
+    std::vector<std::string> incoming;
+    for (auto& l : links)
+        incoming.push_back(std::move(l.in));
+    return incoming;
+}
+
+#endif
+
+const PT Worker::slice(const PT& table) const
+{
+    std::size_t n = table->nRows();
+    std::vector<std::size_t> rows;
+    for (std::size_t i = m_id * n / m_count; i < (m_id + 1) * n / m_count; ++i)
+        rows.push_back(i);
+
+    return Tabular::createFromRows(table, rows, std::make_shared<CategoricalStore>());
+}
+
+const PT Worker::exchange(const PT& local, const CS& keys) const
+{
+#ifdef _WIN32
+    throw std::runtime_error("exchange is not supported on this platform");
+#else
+    std::vector<std::size_t> cs;
+    for (const std::string& k : keys)
+        cs.push_back(local->getSchema().indexOf(k));
+
+    std::vector<std::vector<std::size_t>> rows(m_count);
+    ES key(cs.size());
+    for (std::size_t i = 0; i < local->nRows(); ++i)
+    {
+        for (std::size_t k = 0; k < cs.size(); ++k)
+            key[k] = local->getValue(i, cs[k]);
+        rows[Index::hash(key) % m_count].push_back(i);
+    }
+
+    auto cstore = std::make_shared<CategoricalStore>();
+    std::vector<std::string> outgoing(m_count);
+    PT mine;
+    for (std::size_t d = 0; d < m_count; ++d)
+    {
+        auto part = Tabular::createFromRows(local, rows[d], cstore);
+        if (d == m_id)
+            mine = part;
+        else
+            outgoing[d] = encode(part);
+    }
+
+    auto incoming = transfer(m_peers, outgoing, true, true);
+
+    std::vector<PT> pieces;
+    for (std::size_t d = 0; d < m_count; ++d)
+        pieces.push_back(d == m_id ? mine : decode(incoming[d]));
+
+    return std::make_shared<PartitionedTable>(pieces, Partitioning::Range, CS(), local->getSchema());
+#endif
+}
+
+const PT Cluster::run(const std::function<PT(const Worker&)>& task, const CS& keys) const
+{
+#ifdef _WIN32
+    throw std::runtime_error("clusters are not supported on this platform");
+#else
+    if (m_workers == 0)
+        throw std::invalid_argument("a cluster needs at least one worker");
+
+    std::size_t n = m_workers;
+    std::vector<int> owned;
+    auto pair = [&owned](int& a, int& b) {
+        int fds[2];
+        if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0)
+        {
+            for (int fd : owned)
+                close(fd);
+            throw std::runtime_error("unable to create worker sockets");
+        }
+        a = fds[0];
+        b = fds[1];
+        owned.push_back(a);
+        owned.push_back(b);
+    };
+
+    // worker to worker mesh, and one socket from each worker up to us
+    std::vector<std::vector<int>> mesh(n, std::vector<int>(n, -1));
+    for (std::size_t i = 0; i < n; ++i)
+        for (std::size_t j = i + 1; j < n; ++j)
+            pair(mesh[i][j], mesh[j][i]);
+
+    std::vector<int> up(n), down(n);
+    for (std::size_t i = 0; i < n; ++i)
+        pair(up[i], down[i]);
+
+    // or the children repeat whatever is still buffered
+    std::cout.flush();
+    std::cerr.flush();
+
+    std::vector<pid_t> pids;
+    for (std::size_t w = 0; w < n; ++w)
+    {
+        pid_t pid = fork();
+        if (pid < 0)
+        {
+            for (int fd : owned)
+                close(fd);
+            for (pid_t p : pids)
+                waitpid(p, nullptr, 0);
+            throw std::runtime_error("unable to start worker");
+        }
+
+        if (pid == 0)
+        {
+            for (int fd : owned)
+            {
+                if (fd != down[w] && std::find(mesh[w].begin(), mesh[w].end(), fd) == mesh[w].end())
+                    close(fd);
+            }
+
+            // results cached here would only be thrown away with the
+            // worker, and would count against its memory meanwhile
+            ResultCache::global().setCapacity(0);
+
+            // the result goes up tagged, T and the table, or E and the
+            // error of the task, or P when a peer was lost instead
+            int status = 0;
+            std::string message;
+            try
+            {
+                Worker worker(w, n, mesh[w]);
+                PT result = task(worker);
+                if (!result)
+                    throw std::runtime_error("task returned no table");
+                message = "T" + encode(result);
+            }
+            catch (const PeerLost& e)
+            {
+                message = std::string("P") + e.what();
+                status = 1;
+            }
+            catch (const std::exception& e)
+            {
+                message = std::string("E") + e.what();
+                status = 1;
+            }
+
+            try
+            {
+                transfer({ down[w] }, { message }, true, false);
+            }
+            catch (...)
+            {
+                status = 1;
+            }
+            _exit(status);
+        }
+
+        pids.push_back(pid);
+    }
+
+    for (int fd : owned)
+    {
+        if (std::find(up.begin(), up.end(), fd) == up.end())
+            close(fd);
+    }
+
+    // one worker at a time, a worker that is done no longer depends on
+    // the others, and one that died does not cost us the rest
+    std::vector<std::string> results(n);
+    for (std::size_t w = 0; w < n; ++w)
+    {
+        try
+        {
+            results[w] = transfer({ up[w] }, { std::string() }, false, true)[0];
+        }
+        catch (const std::exception&)
+        {
+        }
+        close(up[w]);
+    }
+
+    std::vector<bool> exited;
+    for (pid_t pid : pids)
+    {
+        int status = 0;
+        waitpid(pid, &status, 0);
+        exited.push_back(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    }
+
+    // the task's own error is the cause, then a worker which died without
+    // a word, lost peers are only what follows from either
+    for (std::size_t w = 0; w < n; ++w)
+    {
+        if (!results[w].empty() && results[w][0] == 'E')
+            throw std::runtime_error("worker " + std::to_string(w) + ": " + results[w].substr(1));
+    }
+    for (std::size_t w = 0; w < n; ++w)
+    {
+        if (results[w].empty())
+            throw std::runtime_error("worker " + std::to_string(w) + " failed");
+    }
+    for (std::size_t w = 0; w < n; ++w)
+    {
+        if (results[w][0] != 'T')
+            throw std::runtime_error("worker " + std::to_string(w) + ": " + results[w].substr(1));
+        if (!exited[w])
+            throw std::runtime_error("worker " + std::to_string(w) + " failed");
+    }
+
+    std::vector<PT> partitions;
+    for (const auto& r : results)
+        partitions.push_back(decode(r.substr(1)));
+
+    return std::make_shared<PartitionedTable>(partitions,
+        keys.empty() ? Partitioning::Range : Partitioning::Hash, keys, partitions[0]->getSchema());
+#endif
+}
+
+const PT Cluster::join(const PT left, const PT right, const CS keys1, const CS keys2) const
+{
+    return run([&](const Worker& w) -> PT {
+        auto l = w.exchange(w.slice(left), keys1);
+        auto r = w.exchange(w.slice(right), keys2);
+        return l->join(r, keys1, keys2);
+    }, keys1);
+}
+
+const PT Cluster::groupBy(const PT source, const CS keys, const AS aggrs) const
+{
+    return run([&](const Worker& w) -> PT {
+        return w.exchange(w.slice(source), keys)->groupBy(keys, aggrs);
+    }, keys);
+}
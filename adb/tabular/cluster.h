@@ -0,0 +1,75 @@
+#pragma once
+
+#include <functional>
+
+#include "tabular.h"
+
+// shared-nothing execution over several worker processes
+// workers own a slice of the base tables each and repartition rows
+// between themselves with exchange(), tables travel in the BinaryWriter
+// format over one stream socket per pair of processes
+// locally the workers are forked and connected with socketpairs, the
+// same sockets could be TCP connections to workers on other nodes, as
+// long as every process agrees on Index::hash
+
+class Worker
+{
+private:
+    const std::size_t m_id;
+    const std::size_t m_count;
+
+    // one socket per peer worker, -1 for ourselves
+    const std::vector<int> m_peers;
+
+public:
+    Worker(std::size_t id, std::size_t count, const std::vector<int>& peers) :
+        m_id(id), m_count(count), m_peers(peers)
+    {}
+
+    const std::size_t id() const
+    {
+        return m_id;
+    }
+
+    const std::size_t count() const
+    {
+        return m_count;
+    }
+
+    // this worker's contiguous share of rows of a table every worker can see
+    const PT slice(const PT& table) const;
+
+    // the shuffle: every worker sends each row of local to the worker its
+    // keys hash to, and gets back all rows hashing to itself
+    // must be called by every worker, in the same order
+    const PT exchange(const PT& local, const CS& keys) const;
+};
+
+class Cluster
+{
+private:
+    const std::size_t m_workers;
+
+public:
+    Cluster(std::size_t workers) :
+        m_workers(workers)
+    {}
+
+    const std::size_t workers() const
+    {
+        return m_workers;
+    }
+
+    // forks the workers, runs task in each of them and gathers the partial
+    // results as partitions of one table
+    // results which come out of an exchange on keys are hash partitioned
+    // on them, as PartitionedTable::hashPartition would, pass keys to keep that
+    // fork only copies the calling thread, so no other thread may be using
+    // the library meanwhile, a lock it holds would stay held in the workers
+    // workers bypass the result cache
+    const PT run(const std::function<PT(const Worker&)>& task, const CS& keys = {}) const;
+
+    // distributed operators over tables created before the fork
+    const PT join(const PT left, const PT right, const CS keys1, const CS keys2) const;
+    const PT groupBy(const PT source, const CS keys, const AS aggrs) const;
+};
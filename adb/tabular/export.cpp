@@ -0,0 +1,341 @@
+#include <charconv>
+#include <cstring>
+#include <deque>
+#include <future>
+#include <limits>
+#include <stdexcept>
+
+#include "export.h"
+
+// formats [begin, end) row chunks with up to threads in flight and
+// writes the finished buffers in row order
+template<typename F>
+static void writeChunked(std::ostream& out, std::size_t nRows, std::size_t threads, std::size_t chunkRows, F format)
+{
+    chunkRows = std::max<std::size_t>(chunkRows, 1);
+
+    if (threads <= 1)
+    {
+        std::string buffer;
+        for (std::size_t begin = 0; begin < nRows; begin += chunkRows)
+        {
+            buffer.clear();
+            format(buffer, begin, std::min(nRows, begin + chunkRows));
+            out.write(buffer.data(), buffer.size());
+        }
+        return;
+    }
+
+    std::deque<std::future<std::string>> pending;
+    auto flushFront = [&out, &pending]() {
+        std::string buffer = pending.front().get();
+        out.write(buffer.data(), buffer.size());
+        pending.pop_front();
+    };
+
+    for (std::size_t begin = 0; begin < nRows; begin += chunkRows)
+    {
+        if (pending.size() == threads)
+            flushFront();
+
+        std::size_t end = std::min(nRows, begin + chunkRows);
+        pending.push_back(std::async(std::launch::async, [&format, begin, end]() -> std::string {
+            std::string buffer;
+            format(buffer, begin, end);
+            return buffer;
+        }));
+    }
+
+    while (!pending.empty())
+        flushFront();
+}
+
+template<typename T>
+static void appendNumber(std::string& buffer, T value)
+{
+    char digits[64];
+    auto result = std::to_chars(digits, digits + sizeof(digits), value);
+    buffer.append(digits, result.ptr);
+}
+
+template<typename T>
+static void appendRaw(std::string& buffer, T value)
+{
+    char bytes[sizeof(T)];
+    std::memcpy(bytes, &value, sizeof(T));
+    buffer.append(bytes, sizeof(T));
+}
+
+void CsvWriter::formatText(std::string& buffer, const std::string& text) const
+{
+    // quoted, or it would read back as a null
+    if (text.empty())
+    {
+        buffer.append("\"\"");
+        return;
+    }
+
+    if (text.find_first_of(std::string({ m_delimiter, '"', '\n', '\r' })) == std::string::npos)
+    {
+        buffer.append(text);
+        return;
+    }
+
+    buffer.push_back('"');
+    for (char ch : text)
+    {
+        if (ch == '"')
+            buffer.push_back('"');
+        buffer.push_back(ch);
+    }
+    buffer.push_back('"');
+}
+
+void CsvWriter::formatRows(const Tabular& table, std::string& buffer, std::size_t begin, std::size_t end) const
+{
+    auto nCols = table.nCols();
+    for (auto i = begin; i < end; ++i)
+    {
+        for (std::size_t j = 0; j < nCols; ++j)
+        {
+            if (j > 0)
+                buffer.push_back(m_delimiter);
+
+            const Entry& v = table.getValue(i, j);
+            switch (v.index())
+            {
+            case 0:
+                break;
+            case 1:
+                appendNumber(buffer, std::get<int>(v));
+                break;
+            case 2:
+                formatText(buffer, std::get<std::string>(v));
+                break;
+            case 3:
+                appendNumber(buffer, std::get<double>(v));
+                break;
+            }
+        }
+        buffer.push_back('\n');
+    }
+}
+
+void CsvWriter::write(const PT& table) const
+{
+    std::string header;
+    const auto& columns = table->getSchema().columns();
+    for (std::size_t j = 0; j < columns.size(); ++j)
+    {
+        if (j > 0)
+            header.push_back(m_delimiter);
+        formatText(header, columns[j].getName());
+    }
+    header.push_back('\n');
+    m_out.write(header.data(), header.size());
+
+    writeChunked(m_out, table->nRows(), m_threads, m_chunkRows,
+        [this, &table](std::string& buffer, std::size_t begin, std::size_t end) {
+            formatRows(*table, buffer, begin, end);
+        });
+    m_out.flush();
+}
+
+void BinaryWriter::formatRows(const Tabular& table, std::string& buffer, std::size_t begin, std::size_t end) const
+{
+    std::size_t n = end - begin;
+    appendRaw<std::uint64_t>(buffer, n);
+
+    const auto& columns = table.getSchema().columns();
+    for (std::size_t j = 0; j < columns.size(); ++j)
+    {
+        // validity first, patched in as the values are visited
+        std::size_t validity = buffer.size();
+        buffer.append((n + 7) / 8, '\0');
+        auto setValid = [&buffer, validity](std::size_t k) { buffer[validity + k / 8] |= char(1 << (k % 8)); };
+
+        switch (columns[j].getDataType())
+        {
+        case DataType::INT:
+            for (std::size_t k = 0; k < n; ++k)
+            {
+                const Entry& v = table.getValue(begin + k, j);
+                std::int32_t value = 0;
+                if (v.index() == 1)
+                {
+                    value = std::get<int>(v);
+                    setValid(k);
+                }
+                appendRaw(buffer, value);
+            }
+            break;
+        case DataType::DOUBLE:
+            for (std::size_t k = 0; k < n; ++k)
+            {
+                const Entry& v = table.getValue(begin + k, j);
+                double value = 0.0;
+                if (v.index() == 3)
+                {
+                    value = std::get<double>(v);
+                    setValid(k);
+                }
+                else if (v.index() == 1)
+                {
+                    value = std::get<int>(v);
+                    setValid(k);
+                }
+                appendRaw(buffer, value);
+            }
+            break;
+        case DataType::TEXT:
+        case DataType::SHORT_TEXT:
+        {
+            std::string bytes;
+            appendRaw<std::uint32_t>(buffer, 0);
+            for (std::size_t k = 0; k < n; ++k)
+            {
+                const Entry& v = table.getValue(begin + k, j);
+                if (v.index() == 2)
+                {
+                    bytes.append(std::get<std::string>(v));
+                    setValid(k);
+                }
+                if (bytes.size() > std::numeric_limits<std::uint32_t>::max())
+                    throw std::runtime_error("more than 4 GiB of text in one row group, use fewer chunkRows");
+                appendRaw(buffer, std::uint32_t(bytes.size()));
+            }
+            buffer.append(bytes);
+            break;
+        }
+        }
+    }
+}
+
+void BinaryWriter::write(const PT& table) const
+{
+    const auto& columns = table->getSchema().columns();
+
+    std::string header("ADB1");
+    appendRaw(header, std::uint32_t(columns.size()));
+    appendRaw(header, std::uint64_t(table->nRows()));
+    for (const auto& c : columns)
+    {
+        appendRaw(header, std::uint32_t(c.getName().size()));
+        header.append(c.getName());
+        appendRaw(header, std::uint8_t(c.getDataType()));
+    }
+    m_out.write(header.data(), header.size());
+
+    writeChunked(m_out, table->nRows(), m_threads, m_chunkRows,
+        [this, &table](std::string& buffer, std::size_t begin, std::size_t end) {
+            formatRows(*table, buffer, begin, end);
+        });
+    m_out.flush();
+}
+
+template<typename T>
+static T readRaw(std::istream& in)
+{
+    T value;
+    if (!in.read(reinterpret_cast<char*>(&value), sizeof(T)))
+        throw std::runtime_error("truncated table stream");
+    return value;
+}
+
+// size comes from the stream, read in pieces so a corrupt size fails on
+// the missing bytes rather than on allocating them
+static std::string readBytes(std::istream& in, std::uint64_t size)
+{
+    const std::uint64_t PIECE = 1 << 16;
+
+    std::string bytes;
+    while (bytes.size() < size)
+    {
+        std::size_t at = bytes.size();
+        std::size_t piece = std::size_t(std::min(size - at, PIECE));
+        bytes.resize(at + piece);
+        if (!in.read(bytes.data() + at, piece))
+            throw std::runtime_error("truncated table stream");
+    }
+    return bytes;
+}
+
+const PT BinaryReader::read() const
+{
+    char magic[4];
+    if (!m_in.read(magic, 4) || std::string(magic, 4) != "ADB1")
+        throw std::runtime_error("not a table stream");
+
+    auto nCols = readRaw<std::uint32_t>(m_in);
+    auto nRows = readRaw<std::uint64_t>(m_in);
+
+    std::vector<ColumnDefinition> defs;
+    for (std::uint32_t j = 0; j < nCols; ++j)
+    {
+        std::string name = readBytes(m_in, readRaw<std::uint32_t>(m_in));
+        auto dt = readRaw<std::uint8_t>(m_in);
+        if (dt > std::uint8_t(DataType::DOUBLE))
+            throw std::runtime_error("unknown data type in table stream");
+        defs.push_back(ColumnDefinition(name, DataType(dt)));
+    }
+
+    // the row count is not trusted for more than a first guess
+    std::vector<ES> entries(nCols);
+    for (auto& e : entries)
+        e.reserve(std::size_t(std::min<std::uint64_t>(nRows, 1 << 16)));
+
+    for (std::uint64_t seen = 0; seen < nRows; )
+    {
+        auto n = readRaw<std::uint64_t>(m_in);
+        if (n == 0 || seen + n > nRows)
+            throw std::runtime_error("malformed table stream");
+        for (std::uint32_t j = 0; j < nCols; ++j)
+        {
+            std::string validity = readBytes(m_in, (n + 7) / 8);
+            auto valid = [&validity](std::size_t k) -> bool { return (validity[k / 8] >> (k % 8)) & 1; };
+
+            switch (defs[j].getDataType())
+            {
+            case DataType::INT:
+                for (std::uint64_t k = 0; k < n; ++k)
+                {
+                    auto v = readRaw<std::int32_t>(m_in);
+                    entries[j].push_back(valid(k) ? Entry(int(v)) : Entry());
+                }
+                break;
+            case DataType::DOUBLE:
+                for (std::uint64_t k = 0; k < n; ++k)
+                {
+                    auto v = readRaw<double>(m_in);
+                    entries[j].push_back(valid(k) ? Entry(v) : Entry());
+                }
+                break;
+            case DataType::TEXT:
+            case DataType::SHORT_TEXT:
+            {
+                std::vector<std::uint32_t> offsets;
+                for (std::uint64_t k = 0; k <= n; ++k)
+                {
+                    offsets.push_back(readRaw<std::uint32_t>(m_in));
+                    if (k > 0 && offsets[k] < offsets[k - 1])
+                        throw std::runtime_error("malformed text offsets in table stream");
+                }
+                if (offsets.front() != 0)
+                    throw std::runtime_error("malformed text offsets in table stream");
+                std::string bytes = readBytes(m_in, offsets.back());
+                for (std::uint64_t k = 0; k < n; ++k)
+                    entries[j].push_back(valid(k) ? Entry(bytes.substr(offsets[k], offsets[k + 1] - offsets[k])) : Entry());
+                break;
+            }
+            }
+        }
+        seen += n;
+    }
+
+    auto cstore = std::make_shared<CategoricalStore>();
+    std::vector<ColumnShard> columns;
+    for (std::uint32_t j = 0; j < nCols; ++j)
+        columns.push_back(ColumnShard(defs[j].getDataType(), entries[j], cstore));
+
+    return Tabular::createFromColumns(Schema(defs), columns);
+}
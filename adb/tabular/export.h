@@ -0,0 +1,75 @@
+#pragma once
+
+#include <istream>
+#include <ostream>
+#include <thread>
+
+#include "tabular.h"
+
+// buffered writers for getting any table out of the process
+// rows are formatted in chunks into large buffers on several threads,
+// and the chunks are written to the stream in order
+class CsvWriter
+{
+private:
+    std::ostream& m_out;
+    const char m_delimiter;
+    const std::size_t m_threads;
+    const std::size_t m_chunkRows;
+
+    void formatRows(const Tabular& table, std::string& buffer, std::size_t begin, std::size_t end) const;
+    void formatText(std::string& buffer, const std::string& text) const;
+
+public:
+    CsvWriter(std::ostream& out, char delimiter = ',',
+        std::size_t threads = std::thread::hardware_concurrency(), std::size_t chunkRows = 65536) :
+        m_out(out), m_delimiter(delimiter), m_threads(threads), m_chunkRows(chunkRows)
+    {}
+
+    // header line then one line per row, nulls are empty fields and
+    // empty strings are ""
+    void write(const PT& table) const;
+};
+
+// columnar binary layout, native byte order
+//   "ADB1", u32 columns, u64 rows
+//   per column: u32 name length, name bytes, u8 DataType
+//   row groups until rows are exhausted:
+//     u64 rows in group
+//     per column: validity bitmap of (rows+7)/8 bytes, then values
+//       INT as i32, DOUBLE as f64,
+//       TEXT/SHORT_TEXT as u32 offsets (rows+1) followed by the bytes,
+//       so a row group holds under 4 GiB of text per column, write throws
+//       std::runtime_error past that
+class BinaryWriter
+{
+private:
+    std::ostream& m_out;
+    const std::size_t m_threads;
+    const std::size_t m_chunkRows;
+
+    void formatRows(const Tabular& table, std::string& buffer, std::size_t begin, std::size_t end) const;
+
+public:
+    BinaryWriter(std::ostream& out,
+        std::size_t threads = std::thread::hardware_concurrency(), std::size_t chunkRows = 65536) :
+        m_out(out), m_threads(threads), m_chunkRows(chunkRows)
+    {}
+
+    void write(const PT& table) const;
+};
+
+// reads the BinaryWriter layout back into a base table
+class BinaryReader
+{
+private:
+    std::istream& m_in;
+
+public:
+    BinaryReader(std::istream& in) :
+        m_in(in)
+    {}
+
+    // throws std::runtime_error on a malformed or truncated stream
+    const PT read() const;
+};
@@ -0,0 +1,231 @@
+#pragma once
+
+#include <cstdint>
+#include <limits>
+#include <string_view>
+
+#include "tabular.h"
+
+// kernels specialised on column types, picked once from the schema
+// inner loops then work on plain values instead of comparing or
+// accumulating Entry variants, the only check left is reading the
+// value out of the Entry each table hands back
+
+enum class KeyKernel {
+    Generic,
+    Int,
+    Double,
+    Text,
+    IntInt
+};
+
+inline KeyKernel keyKernel(const Schema& schema, const CS& keys)
+{
+    std::vector<DataType> types;
+    for (const auto& k : keys)
+        types.push_back(schema.columns()[schema.indexOf(k)].getDataType());
+
+    if (types.size() == 1)
+    {
+        switch (types[0])
+        {
+        case DataType::INT:
+            return KeyKernel::Int;
+        case DataType::DOUBLE:
+            return KeyKernel::Double;
+        default:
+            return KeyKernel::Text;
+        }
+    }
+
+    if (types.size() == 2 && types[0] == DataType::INT && types[1] == DataType::INT)
+        return KeyKernel::IntInt;
+
+    return KeyKernel::Generic;
+}
+
+enum class KeyRead {
+    Value,
+    Null,
+    Mismatch
+};
+
+// a single column key, text keys view the table's own strings
+template<typename K>
+struct KeyReader
+{
+    typedef std::conditional_t<std::is_same_v<K, std::string_view>, std::string, K> Stored;
+
+    static KeyRead read(const Tabular& source, const std::vector<std::size_t>& columns, std::size_t row, K& key)
+    {
+        const Entry& v = source.getValue(row, columns[0]);
+        if (const Stored* p = std::get_if<Stored>(&v))
+        {
+            key = *p;
+            return KeyRead::Value;
+        }
+        return v.index() == 0 ? KeyRead::Null : KeyRead::Mismatch;
+    }
+};
+
+// partially null composite keys are left to the generic index
+template<>
+struct KeyReader<std::pair<int, int>>
+{
+    static KeyRead read(const Tabular& source, const std::vector<std::size_t>& columns, std::size_t row, std::pair<int, int>& key)
+    {
+        const int* a = std::get_if<int>(&source.getValue(row, columns[0]));
+        const int* b = std::get_if<int>(&source.getValue(row, columns[1]));
+        if (a == nullptr || b == nullptr)
+            return KeyRead::Mismatch;
+
+        key = std::pair(*a, *b);
+        return KeyRead::Value;
+    }
+};
+
+// Index keyed on a plain type, null keys are kept as their own group
+// which orders first, as monostate does in the generic Index
+// incomplete when a value does not have the expected type
+template<typename K>
+class TypedIndex
+{
+private:
+    static const std::size_t GROUP_BYTES = 64;
+
+    std::map<K, std::vector<std::size_t>> m_groups;
+    std::vector<std::size_t> m_nulls;
+    Reservation m_reservation;
+    bool m_complete = true;
+
+    // false once a value of another type shows up
+    bool insert(const Tabular& source, const std::vector<std::size_t>& columns, std::size_t i)
+    {
+        K key{};
+        switch (KeyReader<K>::read(source, columns, i, key))
+        {
+        case KeyRead::Value:
+        {
+            auto [it, inserted] = m_groups.try_emplace(key);
+            if (!m_reservation.grow(sizeof(std::size_t) + (inserted ? GROUP_BYTES + sizeof(K) : 0)))
+                throw BudgetExceeded();
+            it->second.push_back(i);
+            return true;
+        }
+        case KeyRead::Null:
+            if (!m_reservation.grow(sizeof(std::size_t)))
+                throw BudgetExceeded();
+            m_nulls.push_back(i);
+            return true;
+        case KeyRead::Mismatch:
+            break;
+        }
+
+        m_complete = false;
+        m_groups.clear();
+        m_nulls.clear();
+        m_reservation.reset();
+        return false;
+    }
+
+public:
+    // throws BudgetExceeded when the groups outgrow the budget
+    TypedIndex(const PT& source, const std::vector<std::size_t>& columns,
+        const std::shared_ptr<MemoryBudget>& budget = nullptr) :
+        m_reservation(budget)
+    {
+        for (std::size_t i = 0; i < source->nRows() && insert(*source, columns, i); ++i)
+            ;
+    }
+
+    // index over a subset of the rows
+    TypedIndex(const PT& source, const std::vector<std::size_t>& columns, const std::vector<std::uint64_t>& rows,
+        const std::shared_ptr<MemoryBudget>& budget = nullptr) :
+        m_reservation(budget)
+    {
+        for (std::size_t k = 0; k < rows.size() && insert(*source, columns, std::size_t(rows[k])); ++k)
+            ;
+    }
+
+    bool complete() const
+    {
+        return m_complete;
+    }
+
+    const std::map<K, std::vector<std::size_t>>& groups() const
+    {
+        return m_groups;
+    }
+
+    const std::vector<std::size_t>& nulls() const
+    {
+        return m_nulls;
+    }
+};
+
+// sums of a column over a group's rows, nulls are skipped and any value
+// of another type makes the sum null, as does an INT sum outside of int
+template<typename V>
+Entry sumRows(const Tabular& source, std::size_t column, const std::vector<std::size_t>& rows)
+{
+    std::conditional_t<std::is_same_v<V, int>, std::int64_t, V> total = 0;
+    for (auto j : rows)
+    {
+        const Entry& v = source.getValue(j, column);
+        if (const V* p = std::get_if<V>(&v))
+            total += *p;
+        else if (v.index() != 0)
+            return std::monostate();
+    }
+
+    // only the final sum has to fit, the wider total holds what comes before
+    if constexpr (std::is_same_v<V, int>)
+    {
+        if (total < std::numeric_limits<int>::min() || total > std::numeric_limits<int>::max())
+            return std::monostate();
+    }
+    return V(total);
+}
+
+inline Entry sumNone(const Tabular& source, std::size_t column, const std::vector<std::size_t>& rows)
+{
+    return std::monostate();
+}
+
+inline SumKernel sumKernel(DataType dt)
+{
+    switch (dt)
+    {
+    case DataType::INT:
+        return sumRows<int>;
+    case DataType::DOUBLE:
+        return sumRows<double>;
+    default:
+        return sumNone;
+    }
+}
+
+// keeps the rows whose column equals value, compacting in place
+template<typename T>
+void keepEqual(const Tabular& source, std::size_t column, const T& value, std::vector<std::size_t>& rows)
+{
+    std::size_t n = 0;
+    for (auto r : rows)
+    {
+        const T* p = std::get_if<T>(&source.getValue(r, column));
+        if (p != nullptr && *p == value)
+            rows[n++] = r;
+    }
+    rows.resize(n);
+}
+
+inline void keepNull(const Tabular& source, std::size_t column, std::vector<std::size_t>& rows)
+{
+    std::size_t n = 0;
+    for (auto r : rows)
+    {
+        if (source.getValue(r, column).index() == 0)
+            rows[n++] = r;
+    }
+    rows.resize(n);
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// set on the threads parallelFor starts
+inline thread_local bool onParallelWorker = false;
+
+// runs f(i) for i in [0, n) on a bounded set of threads
+// nested calls run on the calling worker, or the threads would multiply
+template<typename F>
+void parallelFor(std::size_t n, F f)
+{
+    std::size_t workers = std::min<std::size_t>(n, std::max(1u, std::thread::hardware_concurrency()));
+    if (workers <= 1 || onParallelWorker)
+    {
+        for (std::size_t i = 0; i < n; ++i)
+            f(i);
+        return;
+    }
+
+    std::atomic<std::size_t> next = 0;
+    std::exception_ptr failure;
+    std::mutex failureLock;
+    std::vector<std::thread> threads;
+    for (std::size_t w = 0; w < workers; ++w)
+    {
+        threads.emplace_back([&]() {
+            onParallelWorker = true;
+            for (std::size_t i = next++; i < n; i = next++)
+            {
+                try
+                {
+                    f(i);
+                }
+                catch (...)
+                {
+                    std::lock_guard<std::mutex> lock(failureLock);
+                    failure = std::current_exception();
+                }
+            }
+        });
+    }
+
+    for (auto& t : threads)
+        t.join();
+    if (failure)
+        std::rethrow_exception(failure);
+}
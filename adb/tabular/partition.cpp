@@ -0,0 +1,165 @@
+#include "partition.h"
+#include "parallel.h"
+
+PartitionedTable::PartitionedTable(const std::vector<PT>& partitions,
+    const Partitioning scheme,
+    const CS& keys,
+    const Schema& schema) :
+    m_partitions(partitions), m_scheme(scheme), m_keys(keys), m_schema(schema)
+{
+    m_offsets.push_back(0);
+    for (const PT& p : m_partitions)
+        m_offsets.push_back(m_offsets.back() + p->nRows());
+
+    std::vector<std::size_t> cs;
+    for (const std::string& k : m_keys)
+        cs.push_back(m_schema.indexOf(k));
+
+    m_ranges.resize(m_partitions.size(), std::vector<std::pair<Entry, Entry>>(cs.size()));
+    parallelFor(m_partitions.size(), [this, &cs](std::size_t p) {
+        const PT& partition = m_partitions[p];
+        for (std::size_t k = 0; k < cs.size(); ++k)
+        {
+            auto& range = m_ranges[p][k];
+            for (std::size_t i = 0; i < partition->nRows(); ++i)
+            {
+                const Entry& v = partition->getValue(i, cs[k]);
+                if (v.index() == 0)
+                    continue;
+                if (range.first.index() == 0 || v < range.first)
+                    range.first = v;
+                if (range.second.index() == 0 || range.second < v)
+                    range.second = v;
+            }
+        }
+    });
+}
+
+const PT PartitionedTable::hashPartition(const PT& source, const CS& keys, std::size_t n)
+{
+    if (n == 0)
+        throw std::invalid_argument("hash partitioning needs at least one partition");
+
+    const Schema& schema = source->getSchema();
+    std::vector<std::size_t> cs;
+    for (const std::string& k : keys)
+        cs.push_back(schema.indexOf(k));
+
+    std::vector<std::vector<std::size_t>> rows(n);
+    ES key(cs.size());
+    for (std::size_t i = 0; i < source->nRows(); ++i)
+    {
+        for (std::size_t k = 0; k < cs.size(); ++k)
+            key[k] = source->getValue(i, cs[k]);
+        rows[Index::hash(key) % n].push_back(i);
+    }
+
+    // one store for all partitions keeps codes comparable between them
+    auto cstore = std::make_shared<CategoricalStore>();
+    std::vector<PT> partitions;
+    for (const auto& r : rows)
+        partitions.push_back(Tabular::createFromRows(source, r, cstore));
+
+    return std::make_shared<PartitionedTable>(partitions, Partitioning::Hash, keys, schema);
+}
+
+const Entry& PartitionedTable::getValue(std::size_t row, std::size_t column) const
+{
+    auto it = std::upper_bound(m_offsets.begin(), m_offsets.end(), row);
+    std::size_t p = std::distance(m_offsets.begin(), it) - 1;
+    return m_partitions[p]->getValue(row - m_offsets[p], column);
+}
+
+bool PartitionedTable::mayContain(std::size_t partition, std::size_t key, const Entry& value) const
+{
+    // nulls are not tracked by the ranges
+    if (value.index() == 0)
+        return true;
+
+    const auto& range = m_ranges[partition][key];
+    if (range.first.index() == 0)
+        return false;
+
+    return !(value < range.first) && !(range.second < value);
+}
+
+const PT PartitionedTable::filter(const CS columns, const ES values) const
+{
+    // which of our keys does the filter fix, and to what
+    std::vector<std::optional<Entry>> fixed(m_keys.size());
+    for (std::size_t i = 0; i < columns.size(); ++i)
+    {
+        auto k = std::find(m_keys.begin(), m_keys.end(), columns[i]);
+        if (k != m_keys.end())
+            fixed[std::distance(m_keys.begin(), k)] = values[i];
+    }
+
+    std::optional<std::size_t> hashed;
+    if (m_scheme == Partitioning::Hash && !m_partitions.empty() &&
+        std::all_of(fixed.begin(), fixed.end(), [](const std::optional<Entry>& f) { return f.has_value(); }))
+    {
+        ES key;
+        for (const auto& f : fixed)
+            key.push_back(*f);
+        hashed = Index::hash(key) % m_partitions.size();
+    }
+
+    // pruned partitions stay as empty tables, so partition p still holds
+    // the keys hashing to p and the result can be joined partition-wise
+    std::vector<PT> filtered(m_partitions.size());
+    std::vector<std::size_t> survivors;
+    for (std::size_t p = 0; p < m_partitions.size(); ++p)
+    {
+        bool keep = !hashed.has_value() || *hashed == p;
+        for (std::size_t k = 0; k < fixed.size() && keep; ++k)
+            keep = !fixed[k].has_value() || mayContain(p, k, *fixed[k]);
+
+        if (keep)
+            survivors.push_back(p);
+        else
+            filtered[p] = Tabular::createFromRows(m_partitions[p], {}, std::make_shared<CategoricalStore>());
+    }
+
+    parallelFor(survivors.size(), [this, &survivors, &filtered, &columns, &values](std::size_t i) {
+        filtered[survivors[i]] = m_partitions[survivors[i]]->filter(columns, values);
+    });
+
+    return std::make_shared<PartitionedTable>(filtered, m_scheme, m_keys, m_schema);
+}
+
+const PT PartitionedTable::groupBy(const CS keys, const AS aggrs,
+    const std::shared_ptr<MemoryBudget> budget) const
+{
+    // groups only stay within a partition when hashed on a subset of the group keys
+    bool local = m_scheme == Partitioning::Hash && !m_partitions.empty() &&
+        std::all_of(m_keys.begin(), m_keys.end(), [&keys](const std::string& k) {
+            return std::find(keys.begin(), keys.end(), k) != keys.end(); });
+    if (!local)
+        return Tabular::groupBy(keys, aggrs, budget);
+
+    std::vector<PT> grouped(m_partitions.size());
+    parallelFor(m_partitions.size(), [this, &grouped, &keys, &aggrs, &budget](std::size_t p) {
+        grouped[p] = m_partitions[p]->groupBy(keys, aggrs, budget);
+    });
+
+    return std::make_shared<PartitionedTable>(grouped, Partitioning::Hash, m_keys, grouped[0]->getSchema());
+}
+
+const PT PartitionedTable::join(const PT other, const CS keys1, const CS keys2,
+    const std::shared_ptr<MemoryBudget> budget) const
+{
+    auto right = std::dynamic_pointer_cast<const PartitionedTable>(other);
+    bool wise = right && !m_partitions.empty() &&
+        m_scheme == Partitioning::Hash && right->m_scheme == Partitioning::Hash &&
+        m_partitions.size() == right->m_partitions.size() &&
+        m_keys == keys1 && right->m_keys == keys2;
+    if (!wise)
+        return Tabular::join(other, keys1, keys2, budget);
+
+    std::vector<PT> joined(m_partitions.size());
+    parallelFor(m_partitions.size(), [this, &right, &joined, &keys1, &keys2, &budget](std::size_t p) {
+        joined[p] = m_partitions[p]->join(right->m_partitions[p], keys1, keys2, budget);
+    });
+
+    return std::make_shared<PartitionedTable>(joined, Partitioning::Hash, keys1, joined[0]->getSchema());
+}
@@ -0,0 +1,75 @@
+#pragma once
+
+#include "tabular.h"
+
+enum class Partitioning {
+    Range,  // partitions as they arrived, e.g. one per date or region
+    Hash    // partition i holds exactly the rows whose keys hash to i
+};
+
+// a base table made of many self-contained partitions, usually Table0s,
+// which all share one schema
+// operators run per partition in parallel, filters on the keys prune
+// partitions by their key ranges (and hash for hash partitioning), and
+// joins between tables hashed the same way on the join keys pair up
+// partitions instead of joining the whole tables
+class PartitionedTable : public Tabular
+{
+private:
+    const std::vector<PT> m_partitions;
+    const Partitioning m_scheme;
+    const CS m_keys;
+    const Schema m_schema;
+
+    // first row of each partition, with the total row count at the end
+    std::vector<std::size_t> m_offsets;
+
+    // per partition and key column, the smallest and largest non null value
+    // both null when a partition has no non null values
+    std::vector<std::vector<std::pair<Entry, Entry>>> m_ranges;
+
+    bool mayContain(std::size_t partition, std::size_t key, const Entry& value) const;
+
+public:
+    PartitionedTable(const std::vector<PT>& partitions,
+        const Partitioning scheme,
+        const CS& keys,
+        const Schema& schema);
+
+    // splits source into n hash partitions on keys, each copied into its own shards
+    // n must be at least one
+    static const PT hashPartition(const PT& source, const CS& keys, std::size_t n);
+
+    const Schema& getSchema() const
+    {
+        return m_schema;
+    }
+
+    const std::size_t nRows() const
+    {
+        return m_offsets.back();
+    }
+
+    virtual const Entry& getValue(std::size_t row, std::size_t column) const;
+
+    const std::vector<PT>& partitions() const
+    {
+        return m_partitions;
+    }
+
+    const Partitioning scheme() const
+    {
+        return m_scheme;
+    }
+
+    const CS& keys() const
+    {
+        return m_keys;
+    }
+
+    virtual const PT join(const PT other, const CS keys1, const CS keys2,
+        const std::shared_ptr<MemoryBudget> budget = nullptr) const;
+    virtual const PT groupBy(const CS keys, const AS aggrs,
+        const std::shared_ptr<MemoryBudget> budget = nullptr) const;
+    virtual const PT filter(const CS columns, const ES values) const;
+};
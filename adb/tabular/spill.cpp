@@ -0,0 +1,96 @@
+#include "spill.h"
+
+#ifndef _WIN32
+#include <sys/mman.h>
+#endif
+
+bool MemoryBudget::reserve(std::size_t bytes)
+{
+    std::size_t used = m_used.load();
+    do
+    {
+        if (used + bytes > m_limit)
+            return false;
+    } while (!m_used.compare_exchange_weak(used, used + bytes));
+    return true;
+}
+
+const std::size_t MemoryBudget::partitions(std::size_t rows, std::size_t rowBytes) const
+{
+    // aim for each partition to use a quarter of the budget, but keep
+    // the files open at once well under the descriptor limit, partitions
+    // still too large are split again
+    std::size_t target = std::max<std::size_t>(m_limit / 4, 1);
+    std::size_t n = (rows * rowBytes) / target + 1;
+    return std::clamp<std::size_t>(n, 4, 64);
+}
+
+SpillFile::SpillFile(const std::shared_ptr<MemoryBudget>& budget) :
+    m_file(std::tmpfile()), m_reservation(budget)
+{
+    if (m_file == nullptr)
+        throw std::runtime_error("unable to create spill file");
+}
+
+SpillFile::~SpillFile()
+{
+    std::fclose(m_file);
+}
+
+void SpillFile::flush()
+{
+    if (m_buffer.empty())
+        return;
+
+    if (std::fwrite(m_buffer.data(), sizeof(std::uint64_t), m_buffer.size(), m_file) != m_buffer.size())
+        throw std::runtime_error("unable to write spill file");
+    m_buffer.clear();
+}
+
+void SpillFile::finish()
+{
+    flush();
+    m_buffer = std::vector<std::uint64_t>();
+    m_reservation.reset();
+}
+
+const std::vector<std::uint64_t> SpillFile::readAll()
+{
+    finish();
+    std::vector<std::uint64_t> output(m_count);
+    std::rewind(m_file);
+    if (std::fread(output.data(), sizeof(std::uint64_t), m_count, m_file) != m_count)
+        throw std::runtime_error("unable to read spill file");
+    std::fseek(m_file, 0, SEEK_END);
+    return output;
+}
+
+SpillView::SpillView(SpillFile& file) :
+    m_count(file.size())
+{
+    file.finish();
+    std::fflush(file.m_file);
+    if (m_count == 0)
+        return;
+
+#ifndef _WIN32
+    void* p = mmap(nullptr, m_count * sizeof(std::uint64_t), PROT_READ, MAP_SHARED, fileno(file.m_file), 0);
+    if (p != MAP_FAILED)
+    {
+        m_mapped = m_count * sizeof(std::uint64_t);
+        m_data = static_cast<const std::uint64_t*>(p);
+        return;
+    }
+#endif
+
+    m_loaded = file.readAll();
+    m_data = m_loaded.data();
+}
+
+SpillView::~SpillView()
+{
+#ifndef _WIN32
+    if (m_mapped > 0)
+        munmap(const_cast<std::uint64_t*>(m_data), m_mapped);
+#endif
+}
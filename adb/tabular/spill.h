@@ -0,0 +1,193 @@
+#pragma once
+
+#include <atomic>
+#include <cstdio>
+#include <stdexcept>
+
+#include "central.h"
+
+// per query memory accounting, shared by every operator of the query
+class MemoryBudget
+{
+private:
+    const std::size_t m_limit;
+    std::atomic<std::size_t> m_used = 0;
+
+public:
+    MemoryBudget(std::size_t limit) :
+        m_limit(limit)
+    {}
+
+    const std::size_t limit() const
+    {
+        return m_limit;
+    }
+
+    const std::size_t used() const
+    {
+        return m_used;
+    }
+
+    // nothing is reserved when the request does not fit
+    bool reserve(std::size_t bytes);
+
+    // accounts for memory that cannot be avoided, even past the limit
+    void force(std::size_t bytes)
+    {
+        m_used += bytes;
+    }
+
+    void release(std::size_t bytes)
+    {
+        m_used -= bytes;
+    }
+
+    // partitions needed for rows of roughly rowBytes each to fit comfortably
+    const std::size_t partitions(std::size_t rows, std::size_t rowBytes) const;
+};
+
+class BudgetExceeded : public std::runtime_error
+{
+public:
+    BudgetExceeded() :
+        std::runtime_error("memory budget exceeded")
+    {}
+};
+
+// an operator's share of a budget, given back when it goes away
+// without a budget everything fits
+class Reservation
+{
+private:
+    std::shared_ptr<MemoryBudget> m_budget;
+    std::size_t m_bytes = 0;
+
+public:
+    Reservation(const std::shared_ptr<MemoryBudget>& budget = nullptr) :
+        m_budget(budget)
+    {}
+
+    Reservation(Reservation&& other) noexcept :
+        m_budget(std::move(other.m_budget)), m_bytes(other.m_bytes)
+    {
+        other.m_bytes = 0;
+    }
+
+    Reservation(const Reservation&) = delete;
+    Reservation& operator=(const Reservation&) = delete;
+
+    ~Reservation()
+    {
+        reset();
+    }
+
+    const std::shared_ptr<MemoryBudget>& budget() const
+    {
+        return m_budget;
+    }
+
+    // what has been accounted, also without a budget
+    const std::size_t bytes() const
+    {
+        return m_bytes;
+    }
+
+    bool grow(std::size_t bytes)
+    {
+        if (m_budget && !m_budget->reserve(bytes))
+            return false;
+        m_bytes += bytes;
+        return true;
+    }
+
+    void force(std::size_t bytes)
+    {
+        if (m_budget)
+            m_budget->force(bytes);
+        m_bytes += bytes;
+    }
+
+    void reset()
+    {
+        if (m_budget)
+            m_budget->release(m_bytes);
+        m_bytes = 0;
+    }
+};
+
+// anonymous temporary file for partitions, removed when closed
+// writes are buffered, reads are only allowed once writing is done
+class SpillFile
+{
+private:
+    // the buffer is only allocated by the first write, and is charged
+    // to the budget until writing is done
+    static const std::size_t BUFFER_VALUES = 512;
+
+    std::FILE* m_file;
+    std::vector<std::uint64_t> m_buffer;
+    std::size_t m_count = 0;
+    Reservation m_reservation;
+
+public:
+    SpillFile(const std::shared_ptr<MemoryBudget>& budget = nullptr);
+    ~SpillFile();
+
+    SpillFile(const SpillFile&) = delete;
+    SpillFile& operator=(const SpillFile&) = delete;
+
+    void push_back(std::uint64_t value)
+    {
+        if (m_buffer.capacity() == 0)
+        {
+            m_reservation.force(BUFFER_VALUES * sizeof(std::uint64_t));
+            m_buffer.reserve(BUFFER_VALUES);
+        }
+
+        m_buffer.push_back(value);
+        ++m_count;
+        if (m_buffer.size() == BUFFER_VALUES)
+            flush();
+    }
+
+    const std::size_t size() const
+    {
+        return m_count;
+    }
+
+    void flush();
+
+    // flushes and gives the buffer back, writing again allocates a new one
+    void finish();
+
+    const std::vector<std::uint64_t> readAll();
+
+    friend class SpillView;
+};
+
+// read only view of a finished spill file, mapped where the platform allows
+class SpillView
+{
+private:
+    const std::uint64_t* m_data = nullptr;
+    std::size_t m_count = 0;
+    std::size_t m_mapped = 0;
+    std::vector<std::uint64_t> m_loaded;
+
+public:
+    SpillView(SpillFile& file);
+    ~SpillView();
+
+    SpillView(const SpillView&) = delete;
+    SpillView& operator=(const SpillView&) = delete;
+
+    const std::uint64_t operator[](std::size_t n) const
+    {
+        return m_data[n];
+    }
+
+    const std::size_t size() const
+    {
+        return m_count;
+    }
+};
@@ -1,11 +1,25 @@
+#include <atomic>
+#include <cstring>
 #include <iostream>
 
 #include "tabular.h"
+#include "kernels.h"
+#include "bloom.h"
+#include "cache.h"
+#include "parallel.h"
 
 
 const std::vector<std::size_t> Index::indicies(const std::string column, const Entry value) const
 {
+    // single column keys can go straight to the group
+    if (m_columns.size() == 1)
+    {
+        auto search = m_groups.find(ES({ value }));
+        return search == m_groups.end() ? std::vector<std::size_t>() : search->second;
+    }
+
     std::size_t idx = std::distance(m_columns.begin(), std::find(m_columns.begin(), m_columns.end(), column));
+
     std::vector<std::size_t> indicies;
     for (auto g : m_groups)
     {
@@ -19,6 +33,32 @@ const std::vector<std::size_t> Index::indicies(const std::string column, const E
     return indicies;
 }
 
+const std::size_t Index::hash(const ES& key)
+{
+    std::size_t h = 0;
+    for (const Entry& e : key)
+        h = h * 31 + std::hash<Entry>()(e);
+    return h;
+}
+
+const RowBitmap BitmapIndex::lookup(const Entry& value) const
+{
+    const RowBitmap* bitmap = find(value);
+    return bitmap ? *bitmap : RowBitmap();
+}
+
+const RowBitmap BitmapIndex::lookup(const ES& values) const
+{
+    RowBitmap output;
+    for (const Entry& v : values)
+    {
+        const RowBitmap* bitmap = find(v);
+        if (bitmap)
+            output = output | *bitmap;
+    }
+    return output;
+}
+
 const PT Tabular::createFromColumns(
     const Schema& schema,
     const std::vector<ColumnShard> columns)
@@ -26,6 +66,156 @@ const PT Tabular::createFromColumns(
     return std::make_shared<Table0>(schema, columns);
 }
 
+const PT Tabular::createFromRows(
+    const PT& source,
+    const std::vector<std::size_t>& rows,
+    const std::shared_ptr<CategoricalStore> categoricalStore)
+{
+    const Schema& schema = source->getSchema();
+    std::vector<ColumnShard> columns;
+    for (std::size_t j = 0; j < schema.columns().size(); ++j)
+    {
+        ES entries;
+        entries.reserve(rows.size());
+        for (auto i : rows)
+            entries.push_back(source->getValue(i, j));
+        columns.push_back(ColumnShard(schema.columns()[j].getDataType(), entries, categoricalStore));
+    }
+
+    return createFromColumns(schema, columns);
+}
+
+std::uint64_t Tabular::nextVersion()
+{
+    static std::atomic<std::uint64_t> versions = 0;
+    return ++versions;
+}
+
+// rows read per task when materializing
+static const std::size_t MATERIALIZE_ROWS = 65536;
+
+const PT Tabular::materialize() const
+{
+    if (dynamic_cast<const Table0*>(this))
+        return shared_from_this();
+
+    // each column is read in parallel chunks, the reads are what
+    // walk the chain, encoding into the store then stays on one thread
+    const Schema& schema = getSchema();
+    std::size_t n = nRows();
+    auto cstore = std::make_shared<CategoricalStore>();
+    std::vector<ColumnShard> columns;
+    for (std::size_t j = 0; j < schema.columns().size(); ++j)
+    {
+        ES entries(n);
+        parallelFor((n + MATERIALIZE_ROWS - 1) / MATERIALIZE_ROWS, [this, &entries, n, j](std::size_t c) {
+            for (std::size_t i = c * MATERIALIZE_ROWS; i < std::min(n, (c + 1) * MATERIALIZE_ROWS); ++i)
+                entries[i] = getValue(i, j);
+        });
+        columns.push_back(ColumnShard(schema.columns()[j].getDataType(), std::move(entries), cstore));
+    }
+
+    return std::make_shared<Table0>(schema, columns, fingerprint());
+}
+
+// strings are length prefixed, so no parameter can run into the next
+Fingerprint& Fingerprint::operator<<(const std::string& text)
+{
+    m_text += std::to_string(text.size());
+    m_text.push_back(':');
+    m_text += text;
+    return *this;
+}
+
+Fingerprint& Fingerprint::operator<<(const CS& columns)
+{
+    m_text += "[";
+    for (const auto& c : columns)
+        *this << c;
+    m_text += "]";
+    return *this;
+}
+
+Fingerprint& Fingerprint::operator<<(const Schema& schema)
+{
+    m_text += "[";
+    for (const auto& c : schema.columns())
+    {
+        *this << c.getName();
+        m_text += std::to_string(int(c.getDataType()));
+    }
+    m_text += "]";
+    return *this;
+}
+
+Fingerprint& Fingerprint::operator<<(const AS& aggrs)
+{
+    m_text += "[";
+    for (const auto& [aggr, column, name] : aggrs)
+    {
+        m_text += std::to_string(int(aggr));
+        *this << column;
+        m_text += name.has_value() ? "=" : "_";
+        if (name.has_value())
+            *this << *name;
+    }
+    m_text += "]";
+    return *this;
+}
+
+Fingerprint& Fingerprint::operator<<(const Entry& value)
+{
+    switch (value.index())
+    {
+    case 0:
+        m_text += "n";
+        break;
+    case 1:
+        m_text += "i" + std::to_string(std::get<int>(value)) + ";";
+        break;
+    case 2:
+        m_text += "s";
+        *this << std::get<std::string>(value);
+        break;
+    case 3:
+    {
+        // the exact bits, to_string rounds
+        double d = std::get<double>(value);
+        std::uint64_t bits;
+        std::memcpy(&bits, &d, sizeof(bits));
+        m_text += "d" + std::to_string(bits) + ";";
+        break;
+    }
+    }
+    return *this;
+}
+
+Fingerprint& Fingerprint::operator<<(const ES& values)
+{
+    m_text += "[";
+    for (const auto& v : values)
+        *this << v;
+    m_text += "]";
+    return *this;
+}
+
+Fingerprint& Fingerprint::operator<<(const PT& input)
+{
+    m_text += input->fingerprint();
+    return *this;
+}
+
+// expensive operators go through the result cache when it is on,
+// budgeted calls do not, they asked to keep their results out of memory
+template<typename P, typename B>
+static const PT cached(bool budgeted, P plan, B build)
+{
+    auto& cache = ResultCache::global();
+    if (budgeted || !cache.enabled())
+        return build();
+    return cache.fetch(plan(), build);
+}
+
 void Tabular::basicPrint() const
 {
     const Schema& schema = getSchema();
@@ -35,14 +225,14 @@ void Tabular::basicPrint() const
     {
         std::cout << c.getName() << " | ";
     }
-    std::cout << std::endl;
+    std::cout << "\n";
 
     for (auto i = 0; i < nRows(); ++i)
     {
         std::cout << "| ";
         for (auto j = 0; j < nCols(); ++j)
         {
-            auto v = getValue(i, j);
+            const Entry& v = getValue(i, j);
             switch (v.index())
             {
             case 0:
@@ -60,8 +250,9 @@ void Tabular::basicPrint() const
                         
             std::cout << " | ";
         }
-        std::cout << std::endl;
+        std::cout << "\n";
     }
+    std::cout.flush();
 }
 
 const Entry& Table0::getValue(std::size_t row, std::size_t column) const
@@ -69,6 +260,25 @@ const Entry& Table0::getValue(std::size_t row, std::size_t column) const
     return m_columns[column][row];
 }
 
+bool Table0::createBitmapIndex(const std::string& column) const
+{
+    auto c = m_schema.indexOf(column);
+    if (nRows() > std::numeric_limits<std::uint32_t>::max())
+        return false;
+
+    std::lock_guard<std::mutex> lock(m_bitmaps_lock);
+    if (m_bitmaps.find(c) == m_bitmaps.end())
+        m_bitmaps[c] = std::make_shared<const BitmapIndex>(*this, c);
+    return true;
+}
+
+std::shared_ptr<const BitmapIndex> Table0::bitmapIndex(std::size_t column) const
+{
+    std::lock_guard<std::mutex> lock(m_bitmaps_lock);
+    auto search = m_bitmaps.find(column);
+    return search == m_bitmaps.end() ? nullptr : search->second;
+}
+
 const Entry& Table::getValue(std::size_t row, std::size_t column) const
 {
     return m_underlyings[0]->getValue(row, column);
@@ -126,14 +336,329 @@ const Entry& Concat::getValue(std::size_t row, std::size_t column) const
     }
 }
 
-const PT Tabular::join(const PT other, const CS keys1, const CS keys2) const
+// rough in memory cost of indexing one row, used to size partitions
+static const std::size_t ROW_BYTES = 64;
+
+// how often a partition still over budget is split again, a partition
+// which does not split at all is one key and is held regardless
+static const std::size_t MAX_SPLITS = 4;
+
+// a different spread of the same hash for each seed
+static std::size_t seeded(std::size_t hash, std::size_t seed)
+{
+    if (seed == 0)
+        return hash;
+
+    std::uint64_t h = hash + seed * 0x9e3779b97f4a7c15ULL;
+    h = (h ^ (h >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    h = (h ^ (h >> 27)) * 0x94d049bb133111ebULL;
+    return std::size_t(h ^ (h >> 31));
+}
+
+// the partition of the row of source with the given key columns
+static std::size_t partitionOf(const PT& source, const std::vector<std::size_t>& cs, std::size_t i,
+    std::size_t n, std::size_t seed, ES& key)
 {
-    return std::make_shared<Join>(shared_from_this(), other, keys1, keys2);
+    for (std::size_t k = 0; k < cs.size(); ++k)
+        key[k] = source->getValue(i, cs[k]);
+    return seeded(Index::hash(key), seed) % n;
+}
+
+static std::vector<std::size_t> columnIndices(const PT& source, const CS& columns)
+{
+    std::vector<std::size_t> cs;
+    for (const std::string& c : columns)
+        cs.push_back(source->getSchema().indexOf(c));
+    return cs;
+}
+
+// hash partition the row numbers of source on columns into n spill files
+// only the given rows when there are some, write buffers are charged to
+// budget while partitioning
+static std::vector<std::unique_ptr<SpillFile>> partitionRows(const PT& source, const CS& columns, std::size_t n,
+    const std::shared_ptr<MemoryBudget>& budget, const std::vector<std::uint64_t>* rows = nullptr)
+{
+    auto cs = columnIndices(source, columns);
+
+    std::vector<std::unique_ptr<SpillFile>> partitions;
+    for (std::size_t p = 0; p < n; ++p)
+        partitions.push_back(std::make_unique<SpillFile>(budget));
+
+    ES key(cs.size());
+    if (rows)
+    {
+        for (auto i : *rows)
+            partitions[partitionOf(source, cs, std::size_t(i), n, 0, key)]->push_back(i);
+    }
+    else
+    {
+        for (std::size_t i = 0; i < source->nRows(); ++i)
+            partitions[partitionOf(source, cs, i, n, 0, key)]->push_back(i);
+    }
+
+    for (auto& partition : partitions)
+        partition->finish();
+    return partitions;
+}
+
+// split a partition already read back again, in memory, so deeper splits
+// open no more files
+static std::vector<std::vector<std::uint64_t>> splitRows(const PT& source, const CS& columns, std::size_t n,
+    const std::vector<std::uint64_t>& rows, std::size_t seed)
+{
+    auto cs = columnIndices(source, columns);
+
+    std::vector<std::vector<std::uint64_t>> partitions(n);
+    ES key(cs.size());
+    for (auto i : rows)
+        partitions[partitionOf(source, cs, std::size_t(i), n, seed, key)].push_back(i);
+    return partitions;
+}
+
+// true when no partition got every one of total rows
+static bool splits(const std::vector<std::vector<std::uint64_t>>& partitions, std::size_t total)
+{
+    return std::none_of(partitions.begin(), partitions.end(),
+        [total](const std::vector<std::uint64_t>& p) { return p.size() == total; });
+}
+
+const PT Tabular::join(const PT other, const CS keys1, const CS keys2,
+    const std::shared_ptr<MemoryBudget> budget) const
+{
+    auto self = shared_from_this();
+    return cached(budget != nullptr,
+        [&]() { return Join::plan(self, other, keys1, keys2); },
+        [&]() -> PT { return std::make_shared<Join>(self, other, keys1, keys2, budget); });
+}
+
+void Join::addPair(std::size_t r1, std::size_t r2)
+{
+    if (m_rowindex.size() == m_rowindex.capacity())
+    {
+        std::size_t extra = std::max<std::size_t>(m_rowindex.capacity(), 16);
+        if (!m_reservation.grow(extra * sizeof(std::pair<std::size_t, std::size_t>)))
+            throw BudgetExceeded();
+        m_rowindex.reserve(m_rowindex.capacity() + extra);
+    }
+    m_rowindex.push_back(std::pair(r1, r2));
+}
+
+// the right hand side is the build side, when it is the smaller one its
+// keys are boiled down to a bloom filter and range which the left hand
+// rows are checked against before any of them is indexed
+// a persistent index on the right already has the keys to hand
+const Join::Candidates Join::probeCandidates(Reservation& reservation) const
+{
+    const PT& underlying1 = m_underlyings[0];
+    const PT& underlying2 = m_underlyings[1];
+    if (underlying2->nRows() >= underlying1->nRows())
+        return std::nullopt;
+
+    std::vector<std::size_t> cs1, cs2;
+    for (const std::string& c : m_keys1)
+        cs1.push_back(underlying1->getSchema().indexOf(c));
+    for (const std::string& c : m_keys2)
+        cs2.push_back(underlying2->getSchema().indexOf(c));
+
+    auto bitmap2 = cs2.size() == 1 ? underlying2->bitmapIndex(cs2[0]) : nullptr;
+    auto candidates = bitmap2 ? RuntimeFilter(*bitmap2).scan(underlying1, cs1, reservation)
+        : RuntimeFilter(underlying2, cs2).scan(underlying1, cs1, reservation);
+    if (!candidates)
+        reservation.reset();
+    return candidates;
+}
+
+void Join::buildInMemory(const Candidates& candidates)
+{
+    const PT& underlying1 = m_underlyings[0];
+    const PT& underlying2 = m_underlyings[1];
+    const auto& budget = m_reservation.budget();
+
+    // a single key with a persistent index on the right hand side
+    // is probed directly rather than indexing the right hand side again
+    auto bitmap2 = m_keys2.size() == 1 ? underlying2->bitmapIndex(underlying2->getSchema().indexOf(m_keys2[0])) : nullptr;
+    if (bitmap2)
+    {
+        auto index1 = candidates ? Index(underlying1, m_keys1, *candidates, budget) : Index(underlying1, m_keys1, budget);
+        for (const auto& g1 : index1.groups())
+        {
+            const RowBitmap* other = bitmap2->find(g1.first[0]);
+            if (other)
+            {
+                for (auto r1 : g1.second)
+                    other->forEach([this, r1](std::size_t r2) { addPair(r1, r2); });
+            }
+        }
+        return;
+    }
+
+    auto kernel = keyKernel(underlying1->getSchema(), m_keys1);
+    if (kernel == keyKernel(underlying2->getSchema(), m_keys2))
+    {
+        bool done = false;
+        switch (kernel)
+        {
+        case KeyKernel::Int:
+            done = buildTyped<int>(candidates);
+            break;
+        case KeyKernel::Double:
+            done = buildTyped<double>(candidates);
+            break;
+        case KeyKernel::Text:
+            done = buildTyped<std::string_view>(candidates);
+            break;
+        case KeyKernel::IntInt:
+            done = buildTyped<std::pair<int, int>>(candidates);
+            break;
+        case KeyKernel::Generic:
+            break;
+        }
+        if (done)
+            return;
+    }
+
+    auto index1 = candidates ? Index(underlying1, m_keys1, *candidates, budget) : Index(underlying1, m_keys1, budget);
+    auto index2 = Index(underlying2, m_keys2, budget);
+
+    // here is where the different joins operate
+    // first test is a inner left join
+    const auto& g2s = index2.groups();
+    for (const auto& g1 : index1.groups())
+    {
+        // do we have a matching group in index2?
+        auto other = g2s.find(g1.first);
+        if (other != g2s.end())
+        {
+            for (auto r1 : g1.second)
+                for (auto r2 : other->second)
+                    addPair(r1, r2);
+        }
+    }
+}
+
+// same inner join as the generic path, over plain typed keys
+template<typename K>
+bool Join::buildTyped(const Candidates& candidates)
+{
+    const auto& budget = m_reservation.budget();
+    std::vector<std::size_t> cs1, cs2;
+    for (const std::string& c : m_keys1)
+        cs1.push_back(m_underlyings[0]->getSchema().indexOf(c));
+    for (const std::string& c : m_keys2)
+        cs2.push_back(m_underlyings[1]->getSchema().indexOf(c));
+
+    auto index1 = candidates ? TypedIndex<K>(m_underlyings[0], cs1, *candidates, budget) : TypedIndex<K>(m_underlyings[0], cs1, budget);
+    if (!index1.complete())
+        return false;
+    auto index2 = TypedIndex<K>(m_underlyings[1], cs2, budget);
+    if (!index2.complete())
+        return false;
+
+    for (auto r1 : index1.nulls())
+        for (auto r2 : index2.nulls())
+            addPair(r1, r2);
+
+    const auto& g2s = index2.groups();
+    for (const auto& g1 : index1.groups())
+    {
+        auto other = g2s.find(g1.first);
+        if (other != g2s.end())
+        {
+            for (auto r1 : g1.second)
+                for (auto r2 : other->second)
+                    addPair(r1, r2);
+        }
+    }
+    return true;
+}
+
+void Join::buildSpilled(const Candidates& candidates)
+{
+    const PT& underlying1 = m_underlyings[0];
+    const PT& underlying2 = m_underlyings[1];
+
+    auto n = m_reservation.budget()->partitions((candidates ? candidates->size() : underlying1->nRows()) + underlying2->nRows(), ROW_BYTES);
+    auto lefts = partitionRows(underlying1, m_keys1, n, m_reservation.budget(), candidates ? &*candidates : nullptr);
+    auto rights = partitionRows(underlying2, m_keys2, n, m_reservation.budget());
+
+    SpillFile output(m_reservation.budget());
+    for (std::size_t p = 0; p < n; ++p)
+    {
+        auto l = lefts[p]->readAll();
+        lefts[p].reset();
+        auto r = rights[p]->readAll();
+        rights[p].reset();
+        joinPartition(l, r, 0, output);
+    }
+
+    m_spilled = std::make_unique<SpillView>(output);
+}
+
+// build on the right partition, probe it with the matching left one
+void Join::joinPartition(const std::vector<std::uint64_t>& lefts, const std::vector<std::uint64_t>& rights,
+    std::size_t seed, SpillFile& output)
+{
+    const PT& underlying1 = m_underlyings[0];
+    const PT& underlying2 = m_underlyings[1];
+    const auto& budget = m_reservation.budget();
+
+    Reservation held(budget);
+    std::optional<Index> index2;
+    try
+    {
+        index2.emplace(underlying2, m_keys2, rights, budget);
+    }
+    catch (const BudgetExceeded&)
+    {
+        index2.reset();
+
+        auto n = budget->partitions(lefts.size() + rights.size(), ROW_BYTES);
+        auto ls = splitRows(underlying1, m_keys1, n, lefts, seed + 1);
+        auto rs = splitRows(underlying2, m_keys2, n, rights, seed + 1);
+        if (seed < MAX_SPLITS && splits(rs, rights.size()))
+        {
+            held.force((lefts.size() + rights.size()) * sizeof(std::uint64_t));
+            for (std::size_t p = 0; p < n; ++p)
+            {
+                joinPartition(ls[p], rs[p], seed + 1, output);
+                ls[p] = std::vector<std::uint64_t>();
+                rs[p] = std::vector<std::uint64_t>();
+            }
+            return;
+        }
+
+        // a single key larger than the budget, the rest of the query
+        // at least gets to see what it takes
+        index2.emplace(underlying2, m_keys2, rights);
+        held.force(index2->bytes());
+    }
+
+    std::vector<std::size_t> cs;
+    for (const std::string& c : m_keys1)
+        cs.push_back(underlying1->getSchema().indexOf(c));
+
+    const auto& g2s = index2->groups();
+    ES key(cs.size());
+    for (auto r1 : lefts)
+    {
+        for (std::size_t k = 0; k < cs.size(); ++k)
+            key[k] = underlying1->getValue(r1, cs[k]);
+
+        auto other = g2s.find(key);
+        if (other != g2s.end())
+        {
+            for (auto r2 : other->second)
+            {
+                output.push_back(r1);
+                output.push_back(r2);
+            }
+        }
+    }
 }
 
 const Entry& Join::getValue(std::size_t row, std::size_t column) const
 {
-    auto p = m_rowindex[row];
+    auto p = rowPair(row);
     auto sy = m_underlyings[0]->nCols();
 
     // for now, join does not remove columns from the left table
@@ -147,66 +672,183 @@ const Entry& Join::getValue(std::size_t row, std::size_t column) const
     }
 }
 
-const PT Tabular::groupBy(const CS keys, const AS aggrs) const
+const PT Tabular::groupBy(const CS keys, const AS aggrs,
+    const std::shared_ptr<MemoryBudget> budget) const
 {
-    return std::make_shared<GroupBy>(shared_from_this(), keys, aggrs);
+    auto self = shared_from_this();
+    return cached(budget != nullptr,
+        [&]() { return GroupBy::plan(self, keys, aggrs); },
+        [&]() -> PT { return std::make_shared<GroupBy>(self, keys, aggrs, budget); });
 }
 
-const Entry& GroupBy::getValue(std::size_t row, std::size_t column) const
+void GroupBy::aggregate()
 {
-    auto it = m_index.groups().begin();
-    std::advance(it, row);
-    if (column < m_keys.size()) {
-        return it->first[column];
+    const PT& source = m_underlyings[0];
+    for (const auto& k : m_keys)
+        m_keycols.push_back(source->getSchema().indexOf(k));
+    for (const auto& a : m_aggrs)
+        m_sources.push_back(source->getSchema().indexOf(std::get<1>(a)));
+    for (auto c : m_sources)
+        m_sumkernels.push_back(sumKernel(source->getSchema().columns()[c].getDataType()));
+
+    try
+    {
+        bool done = false;
+        switch (keyKernel(source->getSchema(), m_keys))
+        {
+        case KeyKernel::Int:
+            done = groupTyped<int>();
+            break;
+        case KeyKernel::Double:
+            done = groupTyped<double>();
+            break;
+        case KeyKernel::Text:
+            done = groupTyped<std::string_view>();
+            break;
+        case KeyKernel::IntInt:
+            done = groupTyped<std::pair<int, int>>();
+            break;
+        case KeyKernel::Generic:
+            break;
+        }
+
+        if (!done)
+        {
+            auto index = Index(source, m_keys, m_reservation.budget());
+            for (const auto& g : index.groups())
+                addGroup(g.second);
+        }
     }
-    else
+    catch (const BudgetExceeded&)
     {
-        // calculate the source column
-        std::size_t offset = column - m_keys.size();
-        std::size_t source = m_underlyings[0]->getSchema().indexOf(std::get<1>(m_aggrs[offset]));
+        m_firsts.clear();
+        m_lasts.clear();
+        m_sums.clear();
+        m_reservation.reset();
 
-        // look in cache first
-        if (m_cache.size() < row+1)
-            m_cache.resize(row+1);
+        auto n = m_reservation.budget()->partitions(source->nRows(), ROW_BYTES);
+        auto partitions = partitionRows(source, m_keys, n, m_reservation.budget());
+        for (auto& partition : partitions)
+        {
+            auto rows = partition->readAll();
+            partition.reset();
+            groupPartition(rows, 0);
+        }
+    }
+}
 
-        if (m_cache[row].size() < offset+1)
-            m_cache[row].resize(offset+1);
+void GroupBy::groupPartition(const std::vector<std::uint64_t>& rows, std::size_t seed)
+{
+    const PT& source = m_underlyings[0];
+    const auto& budget = m_reservation.budget();
 
-        std::optional<Entry>& e = m_cache[row][offset];
-        if (e.has_value())
-            return *e;
+    Reservation held(budget);
+    std::optional<Index> index;
+    try
+    {
+        index.emplace(source, m_keys, rows, budget);
+    }
+    catch (const BudgetExceeded&)
+    {
+        index.reset();
 
-        switch (std::get<0>(m_aggrs[offset]))
+        auto n = budget->partitions(rows.size(), ROW_BYTES);
+        auto partitions = splitRows(source, m_keys, n, rows, seed + 1);
+        if (seed < MAX_SPLITS && splits(partitions, rows.size()))
         {
-            case Aggr::uSum:
+            held.force(rows.size() * sizeof(std::uint64_t));
+            for (auto& partition : partitions)
             {
-                Entry v = std::accumulate(it->second.begin(), it->second.end(), Entry(0.0),
-                    [this, source](Entry s, std::size_t j) -> Entry {
-                        if (s.index() == 0)
-                            return s;
-
-                        const Entry& v = m_underlyings[0]->getValue(j, source);
-                        if (v.index() == 0)
-                            return s;
-                        if (v.index() == 3)
-                            return std::get<double>(s) + std::get<double>(v);
-
-                        return std::monostate();
-                    });
-                m_cache[row][offset] = v;
-                return *m_cache[row][offset];
+                groupPartition(partition, seed + 1);
+                partition = std::vector<std::uint64_t>();
             }
-            case Aggr::uFirst:
-                return m_underlyings[0]->getValue(*(it->second.begin()), source);
-            case Aggr::uLast:
-                return m_underlyings[0]->getValue(*(it->second.end()-1), source);
+            return;
         }
+
+        // one group larger than the budget, see Join::joinPartition
+        index.emplace(source, m_keys, rows);
+        held.force(index->bytes());
+    }
+
+    for (const auto& g : index->groups())
+        addGroup(g.second);
+}
+
+template<typename K>
+bool GroupBy::groupTyped()
+{
+    auto index = TypedIndex<K>(m_underlyings[0], m_keycols, m_reservation.budget());
+    if (!index.complete())
+        return false;
+
+    if (!index.nulls().empty())
+        addGroup(index.nulls());
+    for (const auto& g : index.groups())
+        addGroup(g.second);
+    return true;
+}
+
+void GroupBy::addGroup(const std::vector<std::size_t>& rows)
+{
+    // the result itself has to be held, so it is accounted but never refused
+    m_reservation.force(2 * sizeof(std::size_t) + m_aggrs.size() * sizeof(Entry));
+
+    const PT& source = m_underlyings[0];
+    m_firsts.push_back(rows.front());
+    m_lasts.push_back(rows.back());
+
+    std::vector<Entry> sums(m_aggrs.size());
+    for (std::size_t offset = 0; offset < m_aggrs.size(); ++offset)
+    {
+        if (std::get<0>(m_aggrs[offset]) == Aggr::uSum)
+            sums[offset] = m_sumkernels[offset](*source, m_sources[offset], rows);
+    }
+    m_sums.push_back(std::move(sums));
+}
+
+const Entry& GroupBy::getValue(std::size_t row, std::size_t column) const
+{
+    if (column < m_keys.size()) {
+        return m_underlyings[0]->getValue(m_firsts[row], m_keycols[column]);
+    }
+
+    std::size_t offset = column - m_keys.size();
+    switch (std::get<0>(m_aggrs[offset]))
+    {
+        case Aggr::uFirst:
+            return m_underlyings[0]->getValue(m_firsts[row], m_sources[offset]);
+        case Aggr::uLast:
+            return m_underlyings[0]->getValue(m_lasts[row], m_sources[offset]);
+        default:
+            return m_sums[row][offset];
     }
 }
 
 const PT Tabular::filter(const CS columns, const ES values) const
 {
-    return std::make_shared<Filter1>(shared_from_this(), columns, values);
+    auto self = shared_from_this();
+    return cached(false,
+        [&]() { return Filter1::plan(self, columns, values); },
+        [&]() -> PT { return std::make_shared<Filter1>(self, columns, values); });
+}
+
+void Filter1::keep(const Tabular& source, std::size_t column, const Entry& value, std::vector<std::size_t>& rows)
+{
+    switch (value.index())
+    {
+    case 0:
+        keepNull(source, column, rows);
+        break;
+    case 1:
+        keepEqual(source, column, std::get<int>(value), rows);
+        break;
+    case 2:
+        keepEqual(source, column, std::get<std::string>(value), rows);
+        break;
+    case 3:
+        keepEqual(source, column, std::get<double>(value), rows);
+        break;
+    }
 }
 
 const Entry& Filter1::getValue(std::size_t row, std::size_t column) const
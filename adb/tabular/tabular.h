@@ -3,11 +3,19 @@
 #include <numeric>
 #include <map>
 #include <variant>
+#include <mutex>
+#include <limits>
+#include <stdexcept>
 
 #include "central.h"
 #include "schema.h"
+#include "bitmap.h"
+#include "spill.h"
 
 class Tabular; 
+class BitmapIndex;
+struct ArrowSchema;
+struct ArrowArray;
 
 typedef std::variant<std::monostate, int, std::string, double> Entry;
 typedef std::shared_ptr<const Tabular> PT;
@@ -22,6 +30,9 @@ typedef std::vector<Entry> ES;
 class CategoricalStore
 {
 private:
+    // rough cost of a map node, excluding its key and value
+    static const std::size_t NODE_BYTES = 48;
+
     int next_index = 0;
     std::map<std::string, int> m_ab;
     std::map<int, Entry> m_ba;
@@ -46,11 +57,22 @@ public:
         }
     }
 
-    const Entry& operator[](int value)
+    // lookups never insert, only store() writes to the store
+    const Entry& operator[](int value) const
+    {
+        return m_ba.at(value);
+    }
+
+    // rough, each value is held as a key and as an Entry
+    const std::size_t bytes() const
     {
-        return m_ba[value];
+        std::size_t total = 0;
+        for (const auto& v : m_ab)
+            total += 2 * (NODE_BYTES + v.first.size());
+        return total;
     }
 
+    // a writer, must not overlap with reads of shards sharing this store
     const std::vector<int> store(std::vector<std::string> strings)
     {
         std::vector<int> output;
@@ -107,28 +129,83 @@ public:
             [](int d) -> Entry { return Entry(d); });
     }
 
+    // from entries already read out of a table, SHORT_TEXT values are
+    // encoded into the store and nulls are kept as they are, other types
+    // do not hold on to the store
+    ColumnShard(const DataType dt, const std::vector<Entry> entries,
+        const std::shared_ptr<CategoricalStore> categoricalStore = nullptr) :
+        m_dt(dt), m_cstore(dt == DataType::SHORT_TEXT ? categoricalStore : nullptr)
+    {
+        if (m_dt != DataType::SHORT_TEXT)
+        {
+            m_entries = entries;
+            return;
+        }
+
+        std::transform(entries.begin(), entries.end(), std::back_inserter(m_entries),
+            [&categoricalStore](const Entry& e) -> Entry {
+                return e.index() == 2 ? Entry(categoricalStore->operator[](std::get<std::string>(e))) : e; });
+    }
+
     const std::size_t nRows() const
     {
         return m_entries.size();
     }
 
+    // rough, the store is not counted as other shards may share it
+    const std::size_t bytes() const
+    {
+        std::size_t total = m_entries.capacity() * sizeof(Entry);
+        for (const auto& e : m_entries)
+        {
+            if (e.index() == 2)
+                total += std::get<std::string>(e).size();
+        }
+        return total;
+    }
+
+    // SHORT_TEXT shards only
+    const std::shared_ptr<CategoricalStore>& store() const
+    {
+        return m_cstore;
+    }
+
     const Entry& operator[](std::size_t n) const
     {
-        if (m_dt == DataType::SHORT_TEXT)
+        if (m_dt == DataType::SHORT_TEXT && m_entries[n].index() == 1)
             return m_cstore->operator[](std::get<int>(m_entries[n]));
         else
             return m_entries[n];
     }
 };
 
+// tables are immutable once constructed, so a PT may be read from
+// many threads at once, any caches are filled during construction
 class Tabular : public std::enable_shared_from_this<Tabular>
 {
+private:
+    // tables never change, so every new table is a new version
+    const std::uint64_t m_version = nextVersion();
+
+    static std::uint64_t nextVersion();
+
 public:
 
     static const PT createFromColumns(
         const Schema& schema,
         const std::vector<ColumnShard> columns);
 
+    // copies the given rows of source into a new base table,
+    // SHORT_TEXT columns are encoded into categoricalStore
+    static const PT createFromRows(
+        const PT& source,
+        const std::vector<std::size_t>& rows,
+        const std::shared_ptr<CategoricalStore> categoricalStore);
+
+    // Arrow C data interface interchange, see arrow.h
+    static const PT createFromArrow(ArrowSchema* schema, ArrowArray* array);
+    void exportArrow(ArrowSchema* schema, ArrowArray* array) const;
+
     virtual const Schema& getSchema() const = 0;
     virtual const std::size_t nRows() const = 0;
     //virtual const Column& operator[](std::size_t column) const = 0;
@@ -140,43 +217,130 @@ public:
         return getSchema().columns().size();
     }
 
+    // persistent secondary indexes, only base tables of up to 2^32 rows
+    // can hold them
+    // views which preserve row numbers forward the lookup
+    virtual bool createBitmapIndex(const std::string& column) const
+    {
+        return false;
+    }
+
+    virtual std::shared_ptr<const BitmapIndex> bitmapIndex(std::size_t column) const
+    {
+        return nullptr;
+    }
+
     void basicPrint() const;
 
+    // equal fingerprints mean equal contents: operators describe
+    // themselves and their inputs, anything else is its version
+    virtual const std::string fingerprint() const
+    {
+        return "#" + std::to_string(m_version);
+    }
+
+    // evaluates the whole chain once into a base table, in parallel
+    // cells stay Entry, getValue hands out references to them, so what
+    // is saved is the walk down the chain, SHORT_TEXT is coded again
+    const PT materialize() const;
+
     const PT project(const CS columns) const;
     const PT rename(const CS original, const CS renamed) const;
     const PT concat(const PT other, bool horizontal) const;
-    const PT join(const PT other, const CS keys1, const CS keys2) const;
-    const PT groupBy(const CS keys, const AS aggrs) const;
-    const PT filter(const CS columns, const ES values) const;
+    // with a budget, joins and groupBys that would exceed it spill to disk
+    // partitioned tables override these to work partition by partition
+    virtual const PT join(const PT other, const CS keys1, const CS keys2,
+        const std::shared_ptr<MemoryBudget> budget = nullptr) const;
+    virtual const PT groupBy(const CS keys, const AS aggrs,
+        const std::shared_ptr<MemoryBudget> budget = nullptr) const;
+    virtual const PT filter(const CS columns, const ES values) const;
+};
+
+// builds a fingerprint from an operator name, its parameters and inputs
+class Fingerprint
+{
+private:
+    std::string m_text;
+
+public:
+    Fingerprint(const std::string& op) :
+        m_text(op + "(")
+    {}
+
+    Fingerprint& operator<<(const std::string& text);
+    Fingerprint& operator<<(const CS& columns);
+    Fingerprint& operator<<(const Schema& schema);
+    Fingerprint& operator<<(const AS& aggrs);
+    Fingerprint& operator<<(const Entry& value);
+    Fingerprint& operator<<(const ES& values);
+    Fingerprint& operator<<(const PT& input);
+
+    const std::string str() const
+    {
+        return m_text + ")";
+    }
 };
 
 
 class Index
 {
 private:
+    // rough cost of a map node holding a group, excluding the key entries
+    static const std::size_t GROUP_BYTES = 96;
+
     const CS m_columns;
     std::map<std::vector<Entry>, std::vector<std::size_t>> m_groups;
+    Reservation m_reservation;
+
+    void insert(const Tabular& source, const std::vector<std::size_t>& columns, std::size_t i)
+    {
+        ES key;
+        key.reserve(columns.size());
+        for (auto c : columns)
+            key.push_back(source.getValue(i, c));
+
+        auto existing = m_groups.find(key);
+        if (existing == m_groups.end())
+        {
+            if (!m_reservation.grow(GROUP_BYTES + key.size() * sizeof(Entry)))
+                throw BudgetExceeded();
+            m_groups.emplace(std::move(key), std::vector<std::size_t>({ i }));
+        }
+        else
+        {
+            if (!m_reservation.grow(sizeof(std::size_t)))
+                throw BudgetExceeded();
+            existing->second.push_back(i);
+        }
+    }
+
+    static const std::vector<std::size_t> resolve(const PT& source, const CS& columns)
+    {
+        std::vector<std::size_t> output;
+        for (const std::string& c : columns)
+            output.push_back(source->getSchema().indexOf(c));
+        return output;
+    }
 
 public:
-    Index(const PT& source, const CS& columns) :
-        m_columns(columns)
+    // throws BudgetExceeded when the groups outgrow the budget
+    Index(const PT& source, const CS& columns,
+        const std::shared_ptr<MemoryBudget>& budget = nullptr) :
+        m_columns(columns), m_reservation(budget)
     {
+        auto cs = resolve(source, columns);
         for (std::size_t i = 0; i < source->nRows(); ++i)
-        {
-            ES key;
-            for (const std::string& c : columns)
-                key.push_back(source->getValue(i, source->getSchema().indexOf(c)));
+            insert(*source, cs, i);
+    }
 
-            auto existing = m_groups.find(key);
-            if (existing == m_groups.end())
-            {
-                m_groups[key] = std::vector<std::size_t>({ i });
-            }
-            else
-            {
-                existing->second.push_back(i);
-            }
-        }
+    // index over a subset of the rows, such as one spilled partition
+    Index(const PT& source, const CS& columns, const std::vector<std::uint64_t>& rows,
+        const std::shared_ptr<MemoryBudget>& budget = nullptr) :
+        m_columns(columns), m_reservation(budget)
+    {
+        auto cs = resolve(source, columns);
+        for (auto i : rows)
+            insert(*source, cs, std::size_t(i));
     }
 
     const std::map<ES, std::vector<std::size_t>>& groups() const
@@ -184,7 +348,48 @@ public:
         return m_groups;
     }
 
+    // rough size of the groups
+    const std::size_t bytes() const
+    {
+        return m_reservation.bytes();
+    }
+
     const std::vector<std::size_t> indicies(const std::string column, const Entry value) const;
+
+    // the hash used to partition on keys, stable within a process
+    static const std::size_t hash(const ES& key);
+};
+
+class BitmapIndex
+{
+private:
+    std::map<Entry, RowBitmap> m_bitmaps;
+
+public:
+    // row numbers are 32 bit in the bitmaps
+    BitmapIndex(const Tabular& source, std::size_t column)
+    {
+        if (source.nRows() > std::numeric_limits<std::uint32_t>::max())
+            throw std::invalid_argument("too many rows for a bitmap index");
+
+        for (std::size_t i = 0; i < source.nRows(); ++i)
+            m_bitmaps[source.getValue(i, column)].add(std::uint32_t(i));
+    }
+
+    const std::map<Entry, RowBitmap>& bitmaps() const
+    {
+        return m_bitmaps;
+    }
+
+    // nullptr when the value does not occur
+    const RowBitmap* find(const Entry& value) const
+    {
+        auto search = m_bitmaps.find(value);
+        return search == m_bitmaps.end() ? nullptr : &search->second;
+    }
+
+    const RowBitmap lookup(const Entry& value) const;
+    const RowBitmap lookup(const ES& values) const;
 };
 
 
@@ -196,11 +401,23 @@ private:
     const std::vector<ColumnShard> m_columns;
     const Schema m_schema;
 
+    // the fingerprint of the plan this table was materialized from
+    const std::string m_origin;
+
+    // indexes are built on request and then only ever read
+    mutable std::mutex m_bitmaps_lock;
+    mutable std::map<std::size_t, std::shared_ptr<const BitmapIndex>> m_bitmaps;
+
 public:
-    Table0(const Schema& schema, const std::vector<ColumnShard>& columns):
-        m_schema(schema), m_columns(columns)
+    Table0(const Schema& schema, const std::vector<ColumnShard>& columns, const std::string& origin = ""):
+        m_schema(schema), m_columns(columns), m_origin(origin)
     {}
 
+    virtual const std::string fingerprint() const
+    {
+        return m_origin.empty() ? Tabular::fingerprint() : m_origin;
+    }
+
     const Schema& getSchema() const
     {
         return m_schema;
@@ -211,7 +428,28 @@ public:
         return m_columns[0].nRows();
     }
 
+    // each store counted once, however many columns share it
+    const std::size_t bytes() const
+    {
+        std::size_t total = 0;
+        std::vector<const CategoricalStore*> stores;
+        for (const auto& c : m_columns)
+        {
+            total += c.bytes();
+            const CategoricalStore* store = c.store().get();
+            if (store && std::find(stores.begin(), stores.end(), store) == stores.end())
+            {
+                stores.push_back(store);
+                total += store->bytes();
+            }
+        }
+        return total;
+    }
+
     virtual const Entry& getValue(std::size_t row, std::size_t column) const;
+
+    virtual bool createBitmapIndex(const std::string& column) const;
+    virtual std::shared_ptr<const BitmapIndex> bitmapIndex(std::size_t column) const;
 };
 
 class Table : public Tabular
@@ -258,6 +496,16 @@ public:
     }
 
     virtual const Entry& getValue(std::size_t row, std::size_t column) const;
+
+    virtual std::shared_ptr<const BitmapIndex> bitmapIndex(std::size_t column) const
+    {
+        return m_underlyings[0]->bitmapIndex(m_colmap.at(column));
+    }
+
+    virtual const std::string fingerprint() const
+    {
+        return (Fingerprint("project") << m_schema << m_underlyings[0]).str();
+    }
 };
 
 class Rename : public Table
@@ -270,6 +518,16 @@ public:
         Table({ underlying }, underlying->getSchema().rename(original, renamed))
     {
     }
+
+    virtual std::shared_ptr<const BitmapIndex> bitmapIndex(std::size_t column) const
+    {
+        return m_underlyings[0]->bitmapIndex(column);
+    }
+
+    virtual const std::string fingerprint() const
+    {
+        return (Fingerprint("rename") << m_schema << m_underlyings[0]).str();
+    }
 };
 
 
@@ -291,6 +549,11 @@ public:
 
     virtual const std::size_t nRows() const;
     virtual const Entry& getValue(std::size_t row, std::size_t column) const;
+
+    virtual const std::string fingerprint() const
+    {
+        return (Fingerprint(m_horizontal ? "hconcat" : "vconcat") << m_underlyings[0] << m_underlyings[1]).str();
+    }
 };
 
 class Join : public Table
@@ -299,17 +562,39 @@ private:
     const CS m_keys1;
     const CS m_keys2;
 
+    // matching (r1, r2) pairs, in memory or spilled to disk
     std::vector<std::pair<std::size_t, std::size_t>> m_rowindex;
+    std::unique_ptr<SpillView> m_spilled;
     std::map<std::size_t, std::size_t> m_other_colindex;
+    Reservation m_reservation;
+
+    // left rows which may find a partner on the right, or every row
+    typedef std::optional<std::vector<std::uint64_t>> Candidates;
+
+    void addPair(std::size_t r1, std::size_t r2);
+    const Candidates probeCandidates(Reservation& reservation) const;
+    void buildInMemory(const Candidates& candidates);
+    template<typename K> bool buildTyped(const Candidates& candidates);
+    void buildSpilled(const Candidates& candidates);
+    void joinPartition(const std::vector<std::uint64_t>& lefts, const std::vector<std::uint64_t>& rights,
+        std::size_t seed, SpillFile& output);
+
+    const std::pair<std::size_t, std::size_t> rowPair(std::size_t row) const
+    {
+        if (m_spilled)
+            return std::pair(std::size_t((*m_spilled)[2 * row]), std::size_t((*m_spilled)[2 * row + 1]));
+        return m_rowindex[row];
+    }
 
 public:
     Join(const PT underlying1,
         const PT underlying2,
         const CS& keys1,
-        const CS& keys2):
+        const CS& keys2,
+        const std::shared_ptr<MemoryBudget>& budget = nullptr):
         Table({underlying1, underlying2},
             underlying1->getSchema().join(underlying2->getSchema(), keys1, keys2)),
-        m_keys1(keys1), m_keys2(keys2)
+        m_keys1(keys1), m_keys2(keys2), m_reservation(budget)
     {
         // todo: revisit for better impl later?
         auto s = getSchema();
@@ -322,60 +607,96 @@ public:
                 m_other_colindex[s.indexOf(nm)] = so.indexOf(nm);
             }
         }
-        
-        auto index1 = Index(underlying1, keys1);
-        auto index2 = Index(underlying2, keys2);
-
-        // here is where the different joins operate
-        // first test is a inner left join
-        auto g2s = index2.groups();
-        for (auto g1 : index1.groups())
+
+        // held for as long as the candidates are
+        Reservation candidatesHeld(budget);
+        auto candidates = probeCandidates(candidatesHeld);
+
+        // over budget, fall back to a grace hash join over partitions
+        // on disk, the pairs then come out partition by partition
+        try
+        {
+            buildInMemory(candidates);
+        }
+        catch (const BudgetExceeded&)
         {
-            // do we have a matching group in index2?
-            auto other = g2s.find(g1.first);
-            if (other != g2s.end())
-            {
-                for (auto r1 : g1.second)
-                    for (auto r2 : other->second)
-                        m_rowindex.push_back(std::pair(r1, r2));
-            }
+            m_rowindex = {};
+            m_reservation.reset();
+            buildSpilled(candidates);
         }
     }
 
     virtual const std::size_t nRows() const
     {
-        return m_rowindex.size();
+        return m_spilled ? m_spilled->size() / 2 : m_rowindex.size();
     }
 
     virtual const Entry& getValue(std::size_t row, std::size_t column) const;
+
+    // known before the join is built, to look it up in the result cache
+    static const std::string plan(const PT& left, const PT& right, const CS& keys1, const CS& keys2)
+    {
+        return (Fingerprint("join") << keys1 << keys2 << left << right).str();
+    }
+
+    virtual const std::string fingerprint() const
+    {
+        return plan(m_underlyings[0], m_underlyings[1], m_keys1, m_keys2);
+    }
 };
 
+typedef Entry (*SumKernel)(const Tabular& source, std::size_t column, const std::vector<std::size_t>& rows);
+
 class GroupBy : public Table
 {
 private:
     const CS m_keys;
     const AS m_aggrs;
-    const Index m_index;
-
-    // performance cache, beware mutable
-    mutable std::vector<std::vector<std::optional<Entry>> > m_cache;
+    Reservation m_reservation;
+
+    // everything is computed up front so that reads never mutate
+    // a group is its first and last row, keys are read from the first
+    std::vector<std::size_t> m_keycols;
+    std::vector<std::size_t> m_sources;
+    std::vector<std::size_t> m_firsts;
+    std::vector<std::size_t> m_lasts;
+    std::vector<std::vector<Entry>> m_sums;
+    std::vector<SumKernel> m_sumkernels;
+
+    void aggregate();
+    void groupPartition(const std::vector<std::uint64_t>& rows, std::size_t seed);
+    template<typename K> bool groupTyped();
+    void addGroup(const std::vector<std::size_t>& rows);
  
 public:
+    // over budget, the rows are hash partitioned to disk and grouped
+    // one partition at a time, groups are then ordered within partitions
     GroupBy(const PT underlying,
         const CS& keys,
-        const AS& aggrs) :
+        const AS& aggrs,
+        const std::shared_ptr<MemoryBudget>& budget = nullptr) :
         Table({ underlying }, underlying->getSchema().groupBy(keys, aggrs)),
-        m_keys(keys), m_aggrs(aggrs), m_index(Index(underlying, keys))
+        m_keys(keys), m_aggrs(aggrs), m_reservation(budget)
     {
-
+        aggregate();
     }
 
     virtual const std::size_t nRows() const
     {
-        return m_index.groups().size();
+        return m_firsts.size();
     }
 
     virtual const Entry& getValue(std::size_t row, std::size_t column) const;
+
+    static const std::string plan(const PT& source, const CS& keys, const AS& aggrs)
+    {
+        return (Fingerprint("groupBy") << keys << aggrs << source).str();
+    }
+
+    virtual const std::string fingerprint() const
+    {
+        return plan(m_underlyings[0], m_keys, m_aggrs);
+    }
 };
 
 class Filter1 : public Table
@@ -385,6 +706,9 @@ private:
     const ES m_values;
     std::vector<std::size_t> m_rowdex;
 
+    // narrows rows to those where column equals value
+    static void keep(const Tabular& source, std::size_t column, const Entry& value, std::vector<std::size_t>& rows);
+
 public:
     Filter1(const PT underlying,
         const CS& columns,
@@ -392,25 +716,38 @@ public:
         : Table({underlying}, underlying->getSchema()),
         m_columns(columns), m_values(values)
     {
-        // since it is an AND condition, we can scan each individually
-        // and then just keep the final result
-        std::vector<std::size_t> index(underlying->nRows());
-        std::iota(index.begin(), index.end(), 0);
-
+        // indexed columns are answered by intersecting their bitmaps,
+        // the rest are scanned over the surviving rows
+        std::optional<RowBitmap> candidates;
+        std::vector<std::size_t> scans;
         for (auto i = 0; i < columns.size(); ++i)
         {
-            std::vector<std::size_t> index2;
-            auto c = m_schema.indexOf(columns[i]);
-            for (auto j = 0; j < index.size(); ++j)
+            auto bitmap = underlying->bitmapIndex(m_schema.indexOf(columns[i]));
+            if (bitmap)
             {
-                if (underlying->getValue(index[j], c) == values[i])
-                {
-                    index2.push_back(index[j]);
-                }
+                auto rows = bitmap->lookup(values[i]);
+                candidates = candidates.has_value() ? *candidates & rows : rows;
             }
-            index = index2;
+            else
+                scans.push_back(i);
+        }
+
+        // since it is an AND condition, we can scan each individually
+        // and then just keep the final result
+        std::vector<std::size_t> index;
+        if (candidates.has_value())
+        {
+            index = candidates->rows();
+        }
+        else
+        {
+            index.resize(underlying->nRows());
+            std::iota(index.begin(), index.end(), 0);
         }
 
+        for (auto i : scans)
+            keep(*underlying, m_schema.indexOf(columns[i]), values[i], index);
+
         m_rowdex = index;
     }
 
@@ -420,4 +757,14 @@ public:
     }
 
     virtual const Entry& getValue(std::size_t row, std::size_t column) const;
+
+    static const std::string plan(const PT& source, const CS& columns, const ES& values)
+    {
+        return (Fingerprint("filter") << columns << values << source).str();
+    }
+
+    virtual const std::string fingerprint() const
+    {
+        return plan(m_underlyings[0], m_columns, m_values);
+    }
 };
\ No newline at end of file
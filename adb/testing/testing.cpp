@@ -4,6 +4,15 @@
 #include "testing.h"
 #include "tabular.h"
 #include "schema.h"
+#include "export.h"
+#include "arrow.h"
+#include "cluster.h"
+#include "cache.h"
+#include "partition.h"
+
+#include <future>
+#include <set>
+#include <sstream>
 
 using namespace std;
 
@@ -62,5 +71,119 @@ int main()
                                    std::make_tuple(Aggr::uFirst, "D", std::nullopt),
                                    std::make_tuple(Aggr::uLast, "E", std::nullopt) }); // ->project({ "a", "last_E" });
     k->basicPrint();
+    cout << endl;
+
+    // persistent index on the base table, used by filter and join
+    u->createBitmapIndex("A");
+    u->filter({ "A" }, { 3 })->basicPrint();
+    cout << endl;
+    t->join(u, { "a" }, { "A" })->basicPrint();
+    cout << endl;
+
+    CsvWriter(cout).write(k);
+    cout << endl;
+
+    // binary round trip, nulls and empty strings stay apart
+    auto texts = Tabular::createFromColumns(Schema({ ColumnDefinition("t", DataType::TEXT) }),
+        { ColumnShard(DataType::TEXT, { Entry(string("x")), Entry(string()), Entry() }) });
+    stringstream binary;
+    BinaryWriter(binary).write(u->concat(u, false));
+    BinaryReader(binary).read()->basicPrint();
+    CsvWriter(cout).write(texts);
+    cout << endl;
+
+    // results can be read from several threads at once
+    auto render = [&k]() {
+        ostringstream out;
+        CsvWriter(out, ',', 1).write(k);
+        return out.str();
+    };
+    vector<future<string>> readers;
+    for (int i = 0; i < 4; ++i)
+        readers.push_back(async(launch::async, render));
+    bool agree = true;
+    for (auto& r : readers)
+        agree = agree && r.get() == render();
+    cout << "concurrent readers agree: " << agree << endl << endl;
+
+    // INT sums past the range of int come out null rather than wrapped,
+    // only the final sum counts
+    auto big = Tabular::createFromColumns(Schema({ ColumnDefinition("g", DataType::INT), ColumnDefinition("x", DataType::INT) }),
+        { ColumnShard(vector<int>{ 1, 1, 2, 3, 3, 3 }),
+          ColumnShard(vector<int>{ 2000000000, 2000000000, 5, 2000000000, 2000000000, -2000000000 }) });
+    big->groupBy({ "g" }, { std::make_tuple(Aggr::uSum, "x", std::nullopt) })->basicPrint();
+    cout << endl;
+
+    // filters prune hash partitions, and the result stays hash partitioned
+    auto grid = Tabular::createFromColumns(Schema({ ColumnDefinition("a", DataType::INT), ColumnDefinition("b", DataType::INT) }),
+        { ColumnShard(vector<int>{ 0, 0, 1, 1, 2, 2, 3, 3 }), ColumnShard(vector<int>{ 0, 1, 0, 1, 0, 1, 0, 1 }) });
+    auto hashed = PartitionedTable::hashPartition(grid, { "a", "b" }, 5);
+    cout << "pruned filter matches: "
+        << (hashed->filter({ "a" }, { 1 })->filter({ "a", "b" }, { 1, 0 })->nRows() == grid->filter({ "a", "b" }, { 1, 0 })->nRows())
+        << endl << endl;
+
+    // a tight budget spills join and groupBy to disk, rows come out
+    // in another order but are the same
+    auto lines = [](const PT& table) {
+        ostringstream out;
+        CsvWriter(out, ',', 1).write(table);
+        istringstream in(out.str());
+        multiset<string> rows;
+        for (string line; getline(in, line); )
+            rows.insert(line);
+        return rows;
+    };
+    auto budget = make_shared<MemoryBudget>(64);
+    cout << "budgeted join matches: "
+        << (lines(t->join(u, { "a" }, { "A" }, budget)) == lines(t->join(u, { "a" }, { "A" }))) << endl;
+    AS sums = { std::make_tuple(Aggr::uSum, "D", std::nullopt) };
+    cout << "budgeted groupBy matches: "
+        << (lines(u->groupBy({ "A" }, sums, budget)) == lines(u->groupBy({ "A" }, sums))) << endl << endl;
+
+    // a large left side against a small right one goes through the
+    // runtime filter, the other way around it is not used
+    vector<int> facts(10000);
+    for (int i = 0; i < 10000; ++i)
+        facts[i] = i % 500;
+    auto fact = Tabular::createFromColumns(Schema({ ColumnDefinition("f", DataType::INT) }), { ColumnShard(facts) });
+    cout << "bloom filtered join matches: "
+        << (fact->join(u, { "f" }, { "A" })->nRows() == u->join(fact, { "A" }, { "f" })->nRows()) << endl;
+
+    // the same join over two worker processes, and a worker's own error
+    // is what the coordinator reports
+    Cluster cluster(2);
+    cout << "cluster join matches: "
+        << (lines(cluster.join(t, u, { "a" }, { "A" })) == lines(t->join(u, { "a" }, { "A" }))) << endl;
+    try
+    {
+        cluster.run([&t](const Worker& worker) -> PT {
+            if (worker.id() == 1)
+                throw runtime_error("no data here");
+            return worker.exchange(worker.slice(t), { "a" });
+        });
+    }
+    catch (const exception& e)
+    {
+        cout << "cluster failure: " << e.what() << endl << endl;
+    }
+
+    // with the result cache on, the same query is answered from it
+    ResultCache::global().setCapacity(1 << 20);
+    auto query = [&t, &u]() {
+        return t->join(u, { "a" }, { "A" })->groupBy({ "a" }, { std::make_tuple(Aggr::uSum, "D", std::nullopt) });
+    };
+    auto first = query();
+    auto again = query();
+    cout << "cached query matches: " << (lines(again) == lines(first->materialize()))
+        << ", hits " << ResultCache::global().hits() << endl << endl;
+    ResultCache::global().setCapacity(0);
+
+    // arrow round trip, SHORT_TEXT goes out dictionary encoded
+    ArrowSchema as;
+    ArrowArray aa;
+    u->exportArrow(&as, &aa);
+    Tabular::createFromArrow(&as, &aa)->basicPrint();
+    cout << endl;
+
     return 0;
 }